@@ -0,0 +1,214 @@
+//  Copyright 2014 Zwopple Limited
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#import <XCTest/XCTest.h>
+#import <Security/Security.h>
+#import <mach/mach_time.h>
+#import "PSWebSocketMask.h"
+#import "PSWebSocketUTF8Decoder.h"
+
+static const NSUInteger PSWebSocketBenchmarkBytesPerSize = 256 * 1024 * 1024;
+
+// throughput runs push hundreds of megabytes, only run them when asked to with
+// PS_WEBSOCKET_BENCHMARKS=1 in the scheme's environment
+static BOOL PSWebSocketBenchmarksEnabled(void) {
+    return [[NSProcessInfo processInfo].environment[@"PS_WEBSOCKET_BENCHMARKS"] boolValue];
+}
+
+static double PSWebSocketBenchmarkSeconds(uint64_t start, uint64_t end) {
+    static mach_timebase_info_data_t timebase;
+    if(timebase.denom == 0) {
+        mach_timebase_info(&timebase);
+    }
+    return (double)(end - start) * timebase.numer / timebase.denom / NSEC_PER_SEC;
+}
+
+@interface PSWebSocketBenchmarks : XCTestCase
+
+@end
+@implementation PSWebSocketBenchmarks
+
+#pragma mark - Masking
+
+- (void)testMaskThroughput {
+    if(!PSWebSocketBenchmarksEnabled()) {
+        return;
+    }
+    const uint8_t maskKey[4] = {0x37, 0xfa, 0x21, 0x3d};
+    NSArray *sizes = @[@16, @64, @256, @1024, @4096, @(64 * 1024), @(1024 * 1024), @(16 * 1024 * 1024)];
+
+    for(NSNumber *size in sizes) {
+        NSUInteger length = size.unsignedIntegerValue;
+        NSUInteger iterations = MAX(1, PSWebSocketBenchmarkBytesPerSize / length);
+
+        // +1 so the kernels see an unaligned head
+        NSMutableData *data = [NSMutableData dataWithLength:length + 1];
+        SecRandomCopyBytes(kSecRandomDefault, data.length, data.mutableBytes);
+        uint8_t *bytes = (uint8_t *)data.mutableBytes + 1;
+        NSData *original = [NSData dataWithBytes:bytes length:length];
+
+        // byte at a time
+        uint64_t start = mach_absolute_time();
+        for(NSUInteger i = 0; i < iterations; ++i) {
+            uint32_t maskOffset = (uint32_t)i;
+            for(NSUInteger j = 0; j < length; ++j) {
+                bytes[j] = bytes[j] ^ maskKey[maskOffset++ % sizeof(uint32_t)];
+            }
+        }
+        double byteSeconds = PSWebSocketBenchmarkSeconds(start, mach_absolute_time());
+
+        // kernel
+        start = mach_absolute_time();
+        for(NSUInteger i = 0; i < iterations; ++i) {
+            PSWebSocketMaskBytes(bytes, length, maskKey, (uint32_t)i);
+        }
+        double kernelSeconds = PSWebSocketBenchmarkSeconds(start, mach_absolute_time());
+
+        // both passes used the same offsets so every byte was masked an even number of times
+        XCTAssertEqualObjects(original, [NSData dataWithBytes:bytes length:length], @"Masking twice should restore the payload");
+
+        double total = (double)length * iterations / 1e9;
+        NSLog(@"[PSWebSocketBenchmarks][MASK]: %10lu bytes – byte loop %6.2f GB/s, PSWebSocketMaskBytes %6.2f GB/s",
+              (unsigned long)length, total / byteSeconds, total / kernelSeconds);
+    }
+}
+- (void)testMaskOddLengthsAndOffsets {
+    const uint8_t maskKey[4] = {0x37, 0xfa, 0x21, 0x3d};
+    NSMutableData *data = [NSMutableData dataWithLength:200];
+    SecRandomCopyBytes(kSecRandomDefault, data.length, data.mutableBytes);
+    
+    // every alignment of the head and tail around the word & vector loops
+    for(NSUInteger offset = 0; offset < 16; ++offset) {
+        for(NSUInteger length = 0; length < data.length - offset; length += 3) {
+            for(uint32_t maskOffset = 0; maskOffset < 4; ++maskOffset) {
+                NSMutableData *masked = [data mutableCopy];
+                NSMutableData *expected = [data mutableCopy];
+                uint8_t *expectedBytes = (uint8_t *)expected.mutableBytes + offset;
+                for(NSUInteger i = 0; i < length; ++i) {
+                    expectedBytes[i] ^= maskKey[(maskOffset + i) % 4];
+                }
+                PSWebSocketMaskBytes((uint8_t *)masked.mutableBytes + offset, length, maskKey, maskOffset);
+                XCTAssertEqualObjects(expected, masked, @"Masking %@ bytes at offset %@ should match a byte loop", @(length), @(offset));
+                
+                NSMutableData *copied = [NSMutableData dataWithLength:length];
+                PSWebSocketMaskBytesCopy(copied.mutableBytes, (const uint8_t *)data.bytes + offset, length, maskKey, maskOffset);
+                XCTAssertEqualObjects([expected subdataWithRange:NSMakeRange(offset, length)], copied, @"Masking into a copy should match masking in place");
+            }
+        }
+    }
+}
+- (void)testMaskChunked {
+    const uint8_t maskKey[4] = {0x01, 0x02, 0x03, 0x04};
+    NSMutableData *data = [NSMutableData dataWithLength:1031];
+    SecRandomCopyBytes(kSecRandomDefault, data.length, data.mutableBytes);
+
+    NSMutableData *expected = [data mutableCopy];
+    uint8_t *expectedBytes = expected.mutableBytes;
+    for(NSUInteger i = 0; i < expected.length; ++i) {
+        expectedBytes[i] ^= maskKey[i % 4];
+    }
+
+    // mask in odd sized chunks picking up at the returned mask offset
+    uint8_t *bytes = data.mutableBytes;
+    uint32_t maskOffset = 0;
+    NSUInteger offset = 0;
+    for(NSUInteger chunk = 1; offset < data.length; chunk += 7) {
+        NSUInteger length = MIN(chunk, data.length - offset);
+        maskOffset = PSWebSocketMaskBytes(bytes + offset, length, maskKey, maskOffset);
+        offset += length;
+    }
+    XCTAssertEqualObjects(expected, data, @"Chunked masking should match masking in one pass");
+}
+
+#pragma mark - UTF-8
+
+- (NSData *)utf8BenchmarkPayloadWithLength:(NSUInteger)length ascii:(BOOL)ascii {
+    NSString *unit = (ascii) ?
+        @"{\"id\":12345,\"name\":\"PocketSocket\",\"tags\":[\"websocket\",\"rfc6455\"],\"ok\":true}," :
+        @"{\"id\":12345,\"name\":\"Pöcket Söcket\",\"tags\":[\"вебсокет\",\"ウェブソケット\",\"🔌\"]},";
+    NSData *unitData = [unit dataUsingEncoding:NSUTF8StringEncoding];
+    NSMutableData *data = [NSMutableData dataWithCapacity:length + unitData.length];
+    while(data.length < length) {
+        [data appendData:unitData];
+    }
+    return data;
+}
+- (void)testUTF8ValidationThroughput {
+    if(!PSWebSocketBenchmarksEnabled()) {
+        return;
+    }
+    NSArray *sizes = @[@64, @1024, @(64 * 1024), @(1024 * 1024)];
+    for(NSNumber *ascii in @[@YES, @NO]) {
+        for(NSNumber *size in sizes) {
+            NSData *data = [self utf8BenchmarkPayloadWithLength:size.unsignedIntegerValue ascii:ascii.boolValue];
+            const uint8_t *bytes = data.bytes;
+            NSUInteger length = data.length;
+            NSUInteger iterations = MAX(1, PSWebSocketBenchmarkBytesPerSize / 4 / length);
+
+            // byte at a time dfa
+            uint64_t start = mach_absolute_time();
+            uint32_t dfaState = 0;
+            for(NSUInteger i = 0; i < iterations; ++i) {
+                uint32_t state = 0;
+                uint32_t codePoint = 0;
+                for(NSUInteger j = 0; j < length; ++j) {
+                    PSWebSocketUTF8DecoderDecode(&state, &codePoint, bytes[j]);
+                }
+                dfaState |= state;
+            }
+            double dfaSeconds = PSWebSocketBenchmarkSeconds(start, mach_absolute_time());
+
+            // vectorized
+            start = mach_absolute_time();
+            uint32_t validateState = 0;
+            for(NSUInteger i = 0; i < iterations; ++i) {
+                uint32_t state = 0;
+                uint32_t codePoint = 0;
+                validateState |= PSWebSocketUTF8DecoderValidate(&state, &codePoint, bytes, length);
+            }
+            double validateSeconds = PSWebSocketBenchmarkSeconds(start, mach_absolute_time());
+
+            XCTAssertEqual(dfaState, (uint32_t)PSWebSocketUTF8DecoderAccept, @"Benchmark payload should be valid UTF-8");
+            XCTAssertEqual(validateState, (uint32_t)PSWebSocketUTF8DecoderAccept, @"Benchmark payload should be valid UTF-8");
+
+            double total = (double)length * iterations / 1e9;
+            NSLog(@"[PSWebSocketBenchmarks][UTF8]: %10lu bytes %@ – dfa %6.2f GB/s, PSWebSocketUTF8DecoderValidate %6.2f GB/s",
+                  (unsigned long)length, (ascii.boolValue) ? @"ascii    " : @"non-ascii", total / dfaSeconds, total / validateSeconds);
+        }
+    }
+}
+- (void)testUTF8ValidationChunked {
+    NSData *data = [self utf8BenchmarkPayloadWithLength:4096 ascii:NO];
+    const uint8_t *bytes = data.bytes;
+
+    // split at every offset so multi byte sequences straddle chunks
+    for(NSUInteger split = 1; split < 200; ++split) {
+        uint32_t state = 0;
+        uint32_t codePoint = 0;
+        PSWebSocketUTF8DecoderValidate(&state, &codePoint, bytes, split);
+        XCTAssertNotEqual(state, (uint32_t)PSWebSocketUTF8DecoderReject, @"Valid prefix should not be rejected");
+        PSWebSocketUTF8DecoderValidate(&state, &codePoint, bytes + split, data.length - split);
+        XCTAssertEqual(state, (uint32_t)PSWebSocketUTF8DecoderAccept, @"Valid UTF-8 split at %@ should be accepted", @(split));
+    }
+
+    // surrogates & overlongs must be rejected by the vector path too
+    NSMutableData *invalid = [data mutableCopy];
+    const uint8_t surrogate[] = {0xED, 0xA0, 0x80};
+    [invalid replaceBytesInRange:NSMakeRange(100, sizeof(surrogate)) withBytes:surrogate];
+    uint32_t state = 0;
+    uint32_t codePoint = 0;
+    XCTAssertEqual(PSWebSocketUTF8DecoderValidate(&state, &codePoint, invalid.bytes, invalid.length), (uint32_t)PSWebSocketUTF8DecoderReject, @"Surrogates should be rejected");
+}
+
+@end
@@ -0,0 +1,144 @@
+//  Copyright 2014 Zwopple Limited
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#import <XCTest/XCTest.h>
+#import <sys/uio.h>
+#import "PSWebSocketBuffer.h"
+
+static NSData *PSWebSocketBufferTestBytes(NSUInteger length, uint8_t seed) {
+    NSMutableData *data = [NSMutableData dataWithLength:length];
+    uint8_t *bytes = data.mutableBytes;
+    for(NSUInteger i = 0; i < length; ++i) {
+        bytes[i] = (uint8_t)(seed + i);
+    }
+    return data;
+}
+
+static NSData *PSWebSocketBufferTestGather(PSWebSocketBuffer *buffer, NSUInteger *outCount) {
+    struct iovec iovecs[16];
+    NSUInteger count = [buffer getReadableIOVecs:iovecs maxCount:16];
+    NSMutableData *data = [NSMutableData data];
+    for(NSUInteger i = 0; i < count; ++i) {
+        [data appendBytes:iovecs[i].iov_base length:iovecs[i].iov_len];
+    }
+    if(outCount) {
+        *outCount = count;
+    }
+    return data;
+}
+
+@interface PSWebSocketBufferTests : XCTestCase
+
+@end
+@implementation PSWebSocketBufferTests
+
+#pragma mark - Scatter / Gather
+
+- (void)testReserveAndCommitAcrossSegments {
+    PSWebSocketBuffer *buffer = [[PSWebSocketBuffer alloc] init];
+    buffer.segmentLength = 16;
+    NSData *head = PSWebSocketBufferTestBytes(10, 0);
+    [buffer appendData:head];
+    
+    // 6 left in the tail, then whole segments until 40 fit
+    struct iovec iovecs[8];
+    NSUInteger count = [buffer reserve:40 iovecs:iovecs maxCount:8];
+    XCTAssertEqual(count, 4);
+    XCTAssertEqual(iovecs[0].iov_len, 6);
+    XCTAssertEqual(iovecs[1].iov_len, 16);
+    XCTAssertEqual(iovecs[2].iov_len, 16);
+    XCTAssertEqual(iovecs[3].iov_len, 16);
+    
+    NSData *body = PSWebSocketBufferTestBytes(30, 100);
+    const uint8_t *bytes = body.bytes;
+    NSUInteger written = 0;
+    for(NSUInteger i = 0; i < count && written < body.length; ++i) {
+        NSUInteger length = MIN(iovecs[i].iov_len, body.length - written);
+        memcpy(iovecs[i].iov_base, bytes + written, length);
+        written += length;
+    }
+    [buffer commit:written];
+    XCTAssertEqual(buffer.bytesAvailable, 40);
+    
+    // the reserved segment that received nothing is dropped
+    NSMutableData *expected = [head mutableCopy];
+    [expected appendData:body];
+    NSUInteger readableCount = 0;
+    XCTAssertEqualObjects(PSWebSocketBufferTestGather(buffer, &readableCount), expected);
+    XCTAssertEqual(readableCount, 3);
+    
+    [buffer consume:40];
+    XCTAssertFalse(buffer.hasBytesAvailable);
+}
+
+#pragma mark - Contiguous Access
+
+- (void)testExpandContiguousBytesWithStraddlingHeader {
+    PSWebSocketBuffer *buffer = [[PSWebSocketBuffer alloc] init];
+    buffer.segmentLength = 16;
+    NSData *data = PSWebSocketBufferTestBytes(20, 0);
+    [buffer appendData:data];
+    
+    // leave a 6 byte header split 2 / 4 over the segment boundary
+    [buffer consume:14];
+    XCTAssertEqual(buffer.contiguousBytesAvailable, 2);
+    XCTAssertEqual(buffer.bytesAvailable, 6);
+    
+    XCTAssertTrue([buffer expandContiguousBytes]);
+    XCTAssertEqual(buffer.contiguousBytesAvailable, 6);
+    XCTAssertEqual(buffer.bytesAvailable, 6);
+    XCTAssertEqualObjects([NSData dataWithBytes:buffer.bytes length:6], [data subdataWithRange:NSMakeRange(14, 6)]);
+    XCTAssertFalse([buffer expandContiguousBytes]);
+    
+    // appends still land after the expanded header
+    NSData *more = PSWebSocketBufferTestBytes(40, 50);
+    [buffer appendData:more];
+    NSMutableData *expected = [[data subdataWithRange:NSMakeRange(14, 6)] mutableCopy];
+    [expected appendData:more];
+    XCTAssertEqualObjects(PSWebSocketBufferTestGather(buffer, NULL), expected);
+    
+    [buffer reset];
+    XCTAssertFalse(buffer.hasBytesAvailable);
+    XCTAssertEqual(buffer.contiguousBytesAvailable, 0);
+}
+
+- (void)testSharedSegmentsAreNotReused {
+    PSWebSocketBuffer *buffer = [[PSWebSocketBuffer alloc] init];
+    buffer.segmentLength = 16;
+    
+    // a full shared segment is not recycled once consumed
+    [buffer appendData:PSWebSocketBufferTestBytes(16, 0)];
+    NSData *storage = buffer.contiguousStorage;
+    NSData *snapshot = [storage copy];
+    [buffer markContiguousStorageShared];
+    [buffer consume:16];
+    [buffer appendData:PSWebSocketBufferTestBytes(16, 200)];
+    XCTAssertEqualObjects(storage, snapshot);
+    XCTAssertNotEqual(buffer.contiguousStorage, storage);
+    [buffer consume:16];
+    
+    // nor is a partly filled shared tail rewound for appends in place
+    buffer.segmentLength = 32;
+    [buffer reset];
+    [buffer appendData:PSWebSocketBufferTestBytes(8, 0)];
+    storage = buffer.contiguousStorage;
+    snapshot = [[storage subdataWithRange:NSMakeRange(0, 8)] copy];
+    [buffer markContiguousStorageShared];
+    [buffer consume:8];
+    [buffer appendData:PSWebSocketBufferTestBytes(8, 200)];
+    XCTAssertEqualObjects([storage subdataWithRange:NSMakeRange(0, 8)], snapshot);
+    XCTAssertEqualObjects([NSData dataWithBytes:buffer.bytes length:8], PSWebSocketBufferTestBytes(8, 200));
+}
+
+@end
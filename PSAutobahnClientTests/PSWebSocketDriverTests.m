@@ -0,0 +1,695 @@
+//  Copyright 2014 Zwopple Limited
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#import <XCTest/XCTest.h>
+#import "PSWebSocketDriver.h"
+#import "PSWebSocketInternal.h"
+#import "PSWebSocketMask.h"
+#import "PSWebSocketDeflateOptions.h"
+#import "PSWebSocketPreparedMessage.h"
+#import <CommonCrypto/CommonCrypto.h>
+#import <zlib.h>
+
+static NSData *PSWebSocketDriverTestFrame(PSWebSocketOpCode opcode, BOOL fin, BOOL rsv1, NSData *payload, BOOL masked) {
+    NSMutableData *frame = [NSMutableData data];
+    uint8_t header[2] = {0, 0};
+    header[0] = (fin ? PSWebSocketFinMask : 0) | (rsv1 ? PSWebSocketRsv1Mask : 0) | (opcode & PSWebSocketOpCodeMask);
+    header[1] = (masked ? PSWebSocketMaskMask : 0);
+    if(payload.length < 126) {
+        header[1] |= payload.length;
+        [frame appendBytes:header length:sizeof(header)];
+    } else if(payload.length <= UINT16_MAX) {
+        header[1] |= 126;
+        uint16_t length = CFSwapInt16HostToBig((uint16_t)payload.length);
+        [frame appendBytes:header length:sizeof(header)];
+        [frame appendBytes:&length length:sizeof(length)];
+    } else {
+        header[1] |= 127;
+        uint64_t length = CFSwapInt64HostToBig((uint64_t)payload.length);
+        [frame appendBytes:header length:sizeof(header)];
+        [frame appendBytes:&length length:sizeof(length)];
+    }
+    if(masked) {
+        const uint8_t maskKey[4] = {0x37, 0xfa, 0x21, 0x3d};
+        [frame appendBytes:maskKey length:sizeof(maskKey)];
+        NSUInteger offset = frame.length;
+        [frame appendData:payload];
+        PSWebSocketMaskBytes((uint8_t *)frame.mutableBytes + offset, payload.length, maskKey, 0);
+    } else {
+        [frame appendData:payload];
+    }
+    return frame;
+}
+
+// raw deflate with a sync flush and the trailing 00 00 ff ff removed, as permessage-deflate sends it
+static NSData *PSWebSocketDriverTestDeflate(NSData *data, int windowBits) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -windowBits, 8, Z_DEFAULT_STRATEGY);
+    NSMutableData *deflated = [NSMutableData dataWithLength:deflateBound(&stream, data.length) + 16];
+    stream.next_in = (Bytef *)data.bytes;
+    stream.avail_in = (uInt)data.length;
+    stream.next_out = deflated.mutableBytes;
+    stream.avail_out = (uInt)deflated.length;
+    deflate(&stream, Z_SYNC_FLUSH);
+    deflated.length = stream.total_out - 4;
+    deflateEnd(&stream);
+    return deflated;
+}
+
+// returns nil if the stream references bytes outside a window of windowBits
+static NSData *PSWebSocketDriverTestInflate(NSData *data, int windowBits) {
+    NSMutableData *input = [data mutableCopy];
+    const uint8_t trailer[4] = {0x00, 0x00, 0xff, 0xff};
+    [input appendBytes:trailer length:sizeof(trailer)];
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    inflateInit2(&stream, -windowBits);
+    NSMutableData *inflated = [NSMutableData dataWithLength:1024 * 1024];
+    stream.next_in = input.mutableBytes;
+    stream.avail_in = (uInt)input.length;
+    stream.next_out = inflated.mutableBytes;
+    stream.avail_out = (uInt)inflated.length;
+    int ret = inflate(&stream, Z_SYNC_FLUSH);
+    inflated.length = stream.total_out;
+    inflateEnd(&stream);
+    return (ret == Z_OK || ret == Z_STREAM_END) ? inflated : nil;
+}
+
+// the payload of a frame we wrote, unmasked
+static NSData *PSWebSocketDriverTestFramePayload(NSData *frame) {
+    const uint8_t *bytes = frame.bytes;
+    BOOL masked = !!(bytes[1] & PSWebSocketMaskMask);
+    NSUInteger offset = 2;
+    NSUInteger length = (bytes[1] & PSWebSocketPayloadLenMask);
+    if(length == 126) {
+        offset += sizeof(uint16_t);
+    } else if(length == 127) {
+        offset += sizeof(uint64_t);
+    }
+    const uint8_t *maskKey = bytes + offset;
+    offset += (masked) ? 4 : 0;
+    NSMutableData *payload = [[frame subdataWithRange:NSMakeRange(offset, frame.length - offset)] mutableCopy];
+    if(masked) {
+        PSWebSocketMaskBytes(payload.mutableBytes, payload.length, maskKey, 0);
+    }
+    return payload;
+}
+
+// a block of noise repeated so the repeat sits exactly length bytes back
+static NSData *PSWebSocketDriverTestRepeatedNoise(NSUInteger length) {
+    NSMutableData *data = [NSMutableData dataWithLength:length * 2];
+    uint8_t *bytes = data.mutableBytes;
+    uint32_t state = 0x12345678;
+    for(NSUInteger i = 0; i < length; ++i) {
+        state = state * 1103515245 + 12345;
+        bytes[i] = (uint8_t)(state >> 16);
+    }
+    memcpy(bytes + length, bytes, length);
+    return data;
+}
+
+static NSString *PSWebSocketDriverTestAccept(NSString *key) {
+    NSData *data = [[key stringByAppendingString:@"258EAFA5-E914-47DA-95CA-C5AB0DC85B11"] dataUsingEncoding:NSUTF8StringEncoding];
+    unsigned char sha1[CC_SHA1_DIGEST_LENGTH];
+    CC_SHA1(data.bytes, (CC_LONG)data.length, sha1);
+    return [[NSData dataWithBytes:sha1 length:sizeof(sha1)] base64EncodedStringWithOptions:0];
+}
+
+static NSData *PSWebSocketDriverTestText(NSUInteger length) {
+    NSMutableData *data = [NSMutableData dataWithCapacity:length];
+    NSData *line = [@"the quick brown fox jumps over the lazy dog 0123456789\n" dataUsingEncoding:NSUTF8StringEncoding];
+    while(data.length < length) {
+        [data appendBytes:line.bytes length:MIN(line.length, length - data.length)];
+    }
+    return data;
+}
+
+static NSMutableURLRequest *PSWebSocketDriverTestRequest(NSString *extensions) {
+    NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:[NSURL URLWithString:@"ws://localhost/"]];
+    request.HTTPMethod = @"GET";
+    [request setValue:@"dGhlIHNhbXBsZSBub25jZQ==" forHTTPHeaderField:@"Sec-WebSocket-Key"];
+    [request setValue:@"13" forHTTPHeaderField:@"Sec-WebSocket-Version"];
+    [request setValue:@"Upgrade" forHTTPHeaderField:@"Connection"];
+    [request setValue:@"websocket" forHTTPHeaderField:@"Upgrade"];
+    if(extensions) {
+        [request setValue:extensions forHTTPHeaderField:@"Sec-WebSocket-Extensions"];
+    }
+    return request;
+}
+
+@interface PSWebSocketDriverTestRecorder : NSObject <PSWebSocketDriverDelegate>
+
+@property (nonatomic, strong) NSMutableArray *events;
+@property (nonatomic, strong) NSMutableArray *messages;
+@property (nonatomic, strong) NSMutableData *handshake;
+@property (nonatomic, strong) NSMutableArray *frames;
+@property (nonatomic, strong) NSError *error;
+
+@end
+@implementation PSWebSocketDriverTestRecorder
+
+- (instancetype)init {
+    if((self = [super init])) {
+        _events = [NSMutableArray array];
+        _messages = [NSMutableArray array];
+        _handshake = [NSMutableData data];
+        _frames = [NSMutableArray array];
+    }
+    return self;
+}
+- (NSData *)chunkedMessage {
+    NSMutableData *data = [NSMutableData data];
+    for(NSUInteger i = 0; i < _events.count; ++i) {
+        if([_events[i] isEqualToString:@"chunk"]) {
+            [data appendData:_messages[i]];
+        }
+    }
+    return data;
+}
+- (void)driverDidOpen:(PSWebSocketDriver *)driver {
+}
+- (void)driver:(PSWebSocketDriver *)driver didReceiveMessage:(id)message {
+    [_events addObject:@"binary"];
+    [_messages addObject:[message copy]];
+}
+- (void)driver:(PSWebSocketDriver *)driver didReceiveTextMessage:(NSData *)utf8Data {
+    [_events addObject:@"text"];
+    [_messages addObject:[utf8Data copy]];
+}
+- (void)driver:(PSWebSocketDriver *)driver didBeginMessage:(BOOL)binary {
+    [_events addObject:@"begin"];
+    [_messages addObject:@(binary)];
+}
+- (void)driver:(PSWebSocketDriver *)driver didReceiveMessageChunk:(NSData *)chunk {
+    [_events addObject:@"chunk"];
+    [_messages addObject:[chunk copy]];
+}
+- (void)driverDidEndMessage:(PSWebSocketDriver *)driver {
+    [_events addObject:@"end"];
+    [_messages addObject:[NSNull null]];
+}
+- (void)driver:(PSWebSocketDriver *)driver didReceivePing:(NSData *)ping {
+    [_events addObject:@"ping"];
+    [_messages addObject:[ping copy]];
+}
+- (void)driver:(PSWebSocketDriver *)driver didReceivePong:(NSData *)pong {
+    [_events addObject:@"pong"];
+    [_messages addObject:[pong copy]];
+}
+- (void)driver:(PSWebSocketDriver *)driver didFailWithError:(NSError *)error {
+    _error = error;
+}
+- (void)driver:(PSWebSocketDriver *)driver didCloseWithCode:(NSInteger)code reason:(NSString *)reason {
+    [_events addObject:@"close"];
+    [_messages addObject:@(code)];
+}
+- (void)driver:(PSWebSocketDriver *)driver write:(NSData *)data {
+    [_handshake appendData:data];
+}
+- (void)driver:(PSWebSocketDriver *)driver writeHeader:(const void *)header length:(NSUInteger)headerLength payload:(NSData *)payload {
+    NSMutableData *frame = [NSMutableData dataWithBytes:header length:headerLength];
+    [frame appendData:payload];
+    [_frames addObject:frame];
+}
+
+@end
+
+@interface PSWebSocketDriverTests : XCTestCase {
+    PSWebSocketDriverTestRecorder *_recorder;
+}
+
+@end
+@implementation PSWebSocketDriverTests
+
+#pragma mark - Helpers
+
+- (PSWebSocketDriver *)startedServerDriverWithExtensions:(NSString *)extensions {
+    _recorder = [[PSWebSocketDriverTestRecorder alloc] init];
+    PSWebSocketDriver *driver = [PSWebSocketDriver serverDriverWithRequest:PSWebSocketDriverTestRequest(extensions)];
+    driver.delegate = _recorder;
+    [driver start];
+    XCTAssertNil(_recorder.error);
+    XCTAssertGreaterThan(_recorder.handshake.length, 0);
+    return driver;
+}
+
+- (NSDictionary *)handshakeHeadersIsRequest:(BOOL)isRequest {
+    CFHTTPMessageRef msg = CFHTTPMessageCreateEmpty(NULL, isRequest);
+    CFHTTPMessageAppendBytes(msg, _recorder.handshake.bytes, _recorder.handshake.length);
+    NSDictionary *headers = CFBridgingRelease(CFHTTPMessageCopyAllHeaderFields(msg));
+    CFRelease(msg);
+    return headers;
+}
+- (NSString *)negotiatedExtensionsForOffer:(NSString *)offer options:(PSWebSocketDeflateOptions *)options {
+    _recorder = [[PSWebSocketDriverTestRecorder alloc] init];
+    PSWebSocketDriver *driver = [PSWebSocketDriver serverDriverWithRequest:PSWebSocketDriverTestRequest(offer)];
+    driver.deflateOptions = options;
+    driver.delegate = _recorder;
+    [driver start];
+    XCTAssertNil(_recorder.error);
+    return [self handshakeHeadersIsRequest:NO][@"Sec-WebSocket-Extensions"];
+}
+- (PSWebSocketDriver *)openedClientDriverWithOptions:(PSWebSocketDeflateOptions *)options responseExtensions:(NSString *)extensions {
+    _recorder = [[PSWebSocketDriverTestRecorder alloc] init];
+    PSWebSocketDriver *driver = [PSWebSocketDriver clientDriverWithRequest:[NSURLRequest requestWithURL:[NSURL URLWithString:@"ws://localhost/"]]];
+    driver.deflateOptions = options;
+    driver.delegate = _recorder;
+    [driver start];
+    
+    NSString *key = [self handshakeHeadersIsRequest:YES][@"Sec-WebSocket-Key"];
+    NSMutableString *response = [NSMutableString stringWithString:@"HTTP/1.1 101 Switching Protocols\r\n"];
+    [response appendString:@"Upgrade: websocket\r\nConnection: Upgrade\r\n"];
+    [response appendFormat:@"Sec-WebSocket-Accept: %@\r\n", PSWebSocketDriverTestAccept(key)];
+    if(extensions) {
+        [response appendFormat:@"Sec-WebSocket-Extensions: %@\r\n", extensions];
+    }
+    [response appendString:@"\r\n"];
+    [self feed:[response dataUsingEncoding:NSUTF8StringEncoding] toDriver:driver];
+    return driver;
+}
+
+// feeds the bytes the way PSWebSocket does, keeping whatever the driver left
+// unconsumed and appending the next read to it
+- (void)feed:(NSData *)data toDriver:(PSWebSocketDriver *)driver readLength:(NSUInteger)readLength {
+    NSMutableData *pending = [NSMutableData data];
+    NSUInteger offset = 0;
+    while(offset < data.length) {
+        NSUInteger length = MIN(readLength, data.length - offset);
+        [pending appendBytes:(const uint8_t *)data.bytes + offset length:length];
+        offset += length;
+        NSUInteger consumed = [driver execute:pending.mutableBytes maxLength:pending.length];
+        [pending replaceBytesInRange:NSMakeRange(0, consumed) withBytes:NULL length:0];
+        if(_recorder.error) {
+            return;
+        }
+    }
+    XCTAssertEqual(pending.length, 0);
+}
+- (void)feed:(NSData *)data toDriver:(PSWebSocketDriver *)driver {
+    [self feed:data toDriver:driver readLength:data.length];
+}
+
+#pragma mark - Frames
+
+- (void)testSingleFrameAndFragmentedMessages {
+    NSData *text = [@"héllo wörld" dataUsingEncoding:NSUTF8StringEncoding];
+    NSMutableData *binary = [NSMutableData dataWithLength:300];
+    for(NSUInteger i = 0; i < binary.length; ++i) {
+        ((uint8_t *)binary.mutableBytes)[i] = (uint8_t)i;
+    }
+    
+    NSMutableData *input = [NSMutableData data];
+    [input appendData:PSWebSocketDriverTestFrame(PSWebSocketOpCodeText, YES, NO, text, YES)];
+    [input appendData:PSWebSocketDriverTestFrame(PSWebSocketOpCodeBinary, NO, NO, [binary subdataWithRange:NSMakeRange(0, 100)], YES)];
+    [input appendData:PSWebSocketDriverTestFrame(PSWebSocketOpCodePing, YES, NO, [@"ping" dataUsingEncoding:NSUTF8StringEncoding], YES)];
+    [input appendData:PSWebSocketDriverTestFrame(PSWebSocketOpCodeContinuation, NO, NO, [binary subdataWithRange:NSMakeRange(100, 150)], YES)];
+    [input appendData:PSWebSocketDriverTestFrame(PSWebSocketOpCodeContinuation, YES, NO, [binary subdataWithRange:NSMakeRange(250, 50)], YES)];
+    
+    // all at once takes the single frame path for the text message, a byte at a
+    // time splits every header and payload
+    for(NSNumber *readLength in @[@(input.length), @1, @7]) {
+        PSWebSocketDriver *driver = [self startedServerDriverWithExtensions:nil];
+        [self feed:input toDriver:driver readLength:readLength.unsignedIntegerValue];
+        XCTAssertNil(_recorder.error);
+        NSArray *events = @[@"text", @"ping", @"binary"];
+        XCTAssertEqualObjects(_recorder.events, events);
+        XCTAssertEqualObjects(_recorder.messages[0], text);
+        XCTAssertEqualObjects(_recorder.messages[1], [@"ping" dataUsingEncoding:NSUTF8StringEncoding]);
+        XCTAssertEqualObjects(_recorder.messages[2], binary);
+    }
+}
+
+- (void)testExtendedPayloadLengths {
+    NSMutableData *medium = [NSMutableData dataWithLength:1000];
+    NSMutableData *large = [NSMutableData dataWithLength:70000];
+    memset(medium.mutableBytes, 'm', medium.length);
+    memset(large.mutableBytes, 'l', large.length);
+    
+    PSWebSocketDriver *driver = [self startedServerDriverWithExtensions:nil];
+    NSMutableData *input = [NSMutableData data];
+    [input appendData:PSWebSocketDriverTestFrame(PSWebSocketOpCodeBinary, YES, NO, medium, YES)];
+    [input appendData:PSWebSocketDriverTestFrame(PSWebSocketOpCodeBinary, YES, NO, large, YES)];
+    [self feed:input toDriver:driver readLength:4096];
+    XCTAssertNil(_recorder.error);
+    NSArray *events = @[@"binary", @"binary"];
+    XCTAssertEqualObjects(_recorder.events, events);
+    XCTAssertEqualObjects(_recorder.messages[0], medium);
+    XCTAssertEqualObjects(_recorder.messages[1], large);
+}
+
+- (void)testUnmaskedClientFrameIsRejected {
+    PSWebSocketDriver *driver = [self startedServerDriverWithExtensions:nil];
+    NSData *frame = PSWebSocketDriverTestFrame(PSWebSocketOpCodeText, YES, NO, [@"hi" dataUsingEncoding:NSUTF8StringEncoding], NO);
+    [driver execute:[frame mutableCopy].mutableBytes maxLength:frame.length];
+    XCTAssertEqual(_recorder.error.code, PSWebSocketStatusCodeProtocolError);
+    XCTAssertEqual(_recorder.events.count, 0);
+}
+
+- (void)testCompressedFrameWithoutDeflateIsRejected {
+    PSWebSocketDriver *driver = [self startedServerDriverWithExtensions:nil];
+    NSData *frame = PSWebSocketDriverTestFrame(PSWebSocketOpCodeText, YES, YES, [@"hi" dataUsingEncoding:NSUTF8StringEncoding], YES);
+    [driver execute:[frame mutableCopy].mutableBytes maxLength:frame.length];
+    XCTAssertEqual(_recorder.error.code, PSWebSocketStatusCodeProtocolError);
+    XCTAssertEqual(_recorder.events.count, 0);
+}
+
+#pragma mark - UTF-8
+
+- (void)testInvalidUTF8InSingleFrameIsRejected {
+    PSWebSocketDriver *driver = [self startedServerDriverWithExtensions:nil];
+    const uint8_t invalid[] = {'o', 'k', 0xc3, 0x28, 'x'};
+    NSData *frame = PSWebSocketDriverTestFrame(PSWebSocketOpCodeText, YES, NO, [NSData dataWithBytes:invalid length:sizeof(invalid)], YES);
+    [self feed:frame toDriver:driver];
+    XCTAssertEqual(_recorder.error.code, PSWebSocketStatusCodeInvalidUTF8);
+    XCTAssertEqual(_recorder.events.count, 0);
+}
+
+- (void)testTruncatedUTF8InSingleFrameIsRejected {
+    PSWebSocketDriver *driver = [self startedServerDriverWithExtensions:nil];
+    const uint8_t truncated[] = {'o', 'k', 0xe2, 0x82};
+    NSData *frame = PSWebSocketDriverTestFrame(PSWebSocketOpCodeText, YES, NO, [NSData dataWithBytes:truncated length:sizeof(truncated)], YES);
+    [self feed:frame toDriver:driver];
+    XCTAssertEqual(_recorder.error.code, PSWebSocketStatusCodeInvalidUTF8);
+    XCTAssertEqual(_recorder.events.count, 0);
+}
+
+- (void)testUTF8SplitAcrossFragments {
+    // a euro sign split 1 / 2 over the fragment boundary is valid
+    const uint8_t euro[] = {0xe2, 0x82, 0xac};
+    NSMutableData *input = [NSMutableData data];
+    [input appendData:PSWebSocketDriverTestFrame(PSWebSocketOpCodeText, NO, NO, [NSData dataWithBytes:euro length:1], YES)];
+    [input appendData:PSWebSocketDriverTestFrame(PSWebSocketOpCodeContinuation, YES, NO, [NSData dataWithBytes:euro + 1 length:2], YES)];
+    PSWebSocketDriver *driver = [self startedServerDriverWithExtensions:nil];
+    [self feed:input toDriver:driver];
+    XCTAssertNil(_recorder.error);
+    XCTAssertEqualObjects(_recorder.messages.firstObject, [NSData dataWithBytes:euro length:sizeof(euro)]);
+    
+    // ending the message part way through it is not
+    input = [NSMutableData data];
+    [input appendData:PSWebSocketDriverTestFrame(PSWebSocketOpCodeText, NO, NO, [NSData dataWithBytes:euro length:1], YES)];
+    [input appendData:PSWebSocketDriverTestFrame(PSWebSocketOpCodeContinuation, YES, NO, [NSData dataWithBytes:euro + 1 length:1], YES)];
+    driver = [self startedServerDriverWithExtensions:nil];
+    [self feed:input toDriver:driver];
+    XCTAssertEqual(_recorder.error.code, PSWebSocketStatusCodeInvalidUTF8);
+    XCTAssertEqual(_recorder.events.count, 0);
+}
+
+#pragma mark - Storage
+
+- (void)testSingleFrameReferencesStorageOnlyForLargePayloads {
+    // 2048 of an 8192 byte segment is worth pinning, 1500 is copied out instead
+    for(NSNumber *payloadLength in @[@2048, @1500]) {
+        PSWebSocketDriver *driver = [self startedServerDriverWithExtensions:nil];
+        NSMutableData *payload = [NSMutableData dataWithLength:payloadLength.unsignedIntegerValue];
+        memset(payload.mutableBytes, 'p', payload.length);
+        NSData *frame = PSWebSocketDriverTestFrame(PSWebSocketOpCodeBinary, YES, NO, payload, YES);
+        NSMutableData *storage = [NSMutableData dataWithLength:8192];
+        memcpy(storage.mutableBytes, frame.bytes, frame.length);
+        
+        BOOL referenced = NO;
+        NSUInteger consumed = [driver execute:storage.mutableBytes maxLength:frame.length storage:storage storageReferenced:&referenced];
+        XCTAssertEqual(consumed, frame.length);
+        XCTAssertNil(_recorder.error);
+        XCTAssertEqual(referenced, (payload.length == 2048));
+        XCTAssertEqualObjects(_recorder.messages.firstObject, payload);
+    }
+}
+
+#pragma mark - Chunks
+
+- (void)testChunkDeliveryWithoutInflate {
+    NSData *text = PSWebSocketDriverTestText(3000);
+    
+    // a whole single frame message is still handed up as one chunk
+    PSWebSocketDriver *driver = [self startedServerDriverWithExtensions:nil];
+    driver.deliversMessageChunks = YES;
+    [self feed:PSWebSocketDriverTestFrame(PSWebSocketOpCodeText, YES, NO, text, YES) toDriver:driver];
+    XCTAssertNil(_recorder.error);
+    NSArray *events = @[@"begin", @"chunk", @"end"];
+    XCTAssertEqualObjects(_recorder.events, events);
+    XCTAssertEqualObjects(_recorder.messages[0], @NO);
+    XCTAssertEqualObjects(_recorder.chunkedMessage, text);
+    
+    // fragments arriving in small reads go up as they arrive
+    NSMutableData *input = [NSMutableData data];
+    [input appendData:PSWebSocketDriverTestFrame(PSWebSocketOpCodeBinary, NO, NO, [text subdataWithRange:NSMakeRange(0, 1000)], YES)];
+    [input appendData:PSWebSocketDriverTestFrame(PSWebSocketOpCodeContinuation, YES, NO, [text subdataWithRange:NSMakeRange(1000, 2000)], YES)];
+    driver = [self startedServerDriverWithExtensions:nil];
+    driver.deliversMessageChunks = YES;
+    [self feed:input toDriver:driver readLength:256];
+    XCTAssertNil(_recorder.error);
+    XCTAssertEqualObjects(_recorder.events.firstObject, @"begin");
+    XCTAssertEqualObjects(_recorder.messages.firstObject, @YES);
+    XCTAssertEqualObjects(_recorder.events.lastObject, @"end");
+    XCTAssertGreaterThan([_recorder.events indexesOfObjectsPassingTest:^BOOL(id obj, NSUInteger idx, BOOL *stop) {
+        return [obj isEqualToString:@"chunk"];
+    }].count, 2);
+    XCTAssertFalse([_recorder.events containsObject:@"binary"]);
+    XCTAssertEqualObjects(_recorder.chunkedMessage, text);
+}
+
+- (void)testChunkDeliveryWithInflate {
+    NSData *text = PSWebSocketDriverTestText(20000);
+    NSData *frame = PSWebSocketDriverTestFrame(PSWebSocketOpCodeText, YES, YES, PSWebSocketDriverTestDeflate(text, 9), YES);
+    
+    // inflated output goes up as each read is inflated
+    PSWebSocketDriver *driver = [self startedServerDriverWithExtensions:@"permessage-deflate"];
+    driver.deliversMessageChunks = YES;
+    [self feed:frame toDriver:driver readLength:16];
+    XCTAssertNil(_recorder.error);
+    XCTAssertEqualObjects(_recorder.events.firstObject, @"begin");
+    XCTAssertEqualObjects(_recorder.events.lastObject, @"end");
+    XCTAssertGreaterThan([_recorder.events indexesOfObjectsPassingTest:^BOOL(id obj, NSUInteger idx, BOOL *stop) {
+        return [obj isEqualToString:@"chunk"];
+    }].count, 1);
+    XCTAssertFalse([_recorder.events containsObject:@"text"]);
+    XCTAssertEqualObjects(_recorder.chunkedMessage, text);
+    
+    // and the same frame without chunks is one inflated message
+    driver = [self startedServerDriverWithExtensions:@"permessage-deflate"];
+    [self feed:frame toDriver:driver readLength:16];
+    XCTAssertNil(_recorder.error);
+    NSArray *events = @[@"text"];
+    XCTAssertEqualObjects(_recorder.events, events);
+    XCTAssertEqualObjects(_recorder.messages.firstObject, text);
+}
+
+#pragma mark - Limits
+
+- (void)testMaxFrameLength {
+    NSMutableData *payload = [NSMutableData dataWithLength:100];
+    PSWebSocketDriver *driver = [self startedServerDriverWithExtensions:nil];
+    driver.maxFrameLength = 100;
+    [self feed:PSWebSocketDriverTestFrame(PSWebSocketOpCodeBinary, YES, NO, payload, YES) toDriver:driver];
+    XCTAssertNil(_recorder.error);
+    XCTAssertEqual(_recorder.events.count, 1);
+    
+    payload.length = 101;
+    [self feed:PSWebSocketDriverTestFrame(PSWebSocketOpCodeBinary, YES, NO, payload, YES) toDriver:driver];
+    XCTAssertEqual(_recorder.error.code, PSWebSocketStatusCodeMessageTooBig);
+    XCTAssertEqual(_recorder.events.count, 1);
+}
+
+- (void)testMaxFrameLengthCheckedBeforePayloadArrives {
+    PSWebSocketDriver *driver = [self startedServerDriverWithExtensions:nil];
+    driver.maxFrameLength = 1024 * 1024;
+    
+    // only the header of a frame claiming a terabyte
+    uint8_t header[14] = {PSWebSocketFinMask | PSWebSocketOpCodeBinary, PSWebSocketMaskMask | 127};
+    uint64_t length = CFSwapInt64HostToBig(1ULL << 40);
+    memcpy(header + 2, &length, sizeof(length));
+    [driver execute:header maxLength:sizeof(header)];
+    XCTAssertEqual(_recorder.error.code, PSWebSocketStatusCodeMessageTooBig);
+}
+
+- (void)testMaxMessageLength {
+    NSData *fragment = [NSMutableData dataWithLength:60];
+    NSMutableData *input = [NSMutableData data];
+    [input appendData:PSWebSocketDriverTestFrame(PSWebSocketOpCodeBinary, NO, NO, fragment, YES)];
+    [input appendData:PSWebSocketDriverTestFrame(PSWebSocketOpCodeContinuation, YES, NO, fragment, YES)];
+    
+    // each frame fits but the message doesn't
+    PSWebSocketDriver *driver = [self startedServerDriverWithExtensions:nil];
+    driver.maxFrameLength = 100;
+    driver.maxMessageLength = 100;
+    [self feed:input toDriver:driver];
+    XCTAssertEqual(_recorder.error.code, PSWebSocketStatusCodeMessageTooBig);
+    XCTAssertEqual(_recorder.events.count, 0);
+    
+    driver = [self startedServerDriverWithExtensions:nil];
+    driver.maxMessageLength = 120;
+    [self feed:input toDriver:driver];
+    XCTAssertNil(_recorder.error);
+    XCTAssertEqual(_recorder.events.count, 1);
+}
+
+- (void)testMaxInflatedMessageLength {
+    NSData *text = PSWebSocketDriverTestText(10000);
+    NSData *frame = PSWebSocketDriverTestFrame(PSWebSocketOpCodeText, YES, YES, PSWebSocketDriverTestDeflate(text, 9), YES);
+    
+    // a few hundred bytes on the wire, too large once inflated
+    PSWebSocketDriver *driver = [self startedServerDriverWithExtensions:@"permessage-deflate"];
+    driver.maxMessageLength = 1000;
+    driver.maxInflatedMessageLength = 1000;
+    [self feed:frame toDriver:driver];
+    XCTAssertEqual(_recorder.error.code, PSWebSocketStatusCodeMessageTooBig);
+    XCTAssertEqual(_recorder.events.count, 0);
+    
+    driver = [self startedServerDriverWithExtensions:@"permessage-deflate"];
+    driver.maxInflatedMessageLength = 10000;
+    [self feed:frame toDriver:driver];
+    XCTAssertNil(_recorder.error);
+    XCTAssertEqualObjects(_recorder.messages.firstObject, text);
+}
+
+#pragma mark - permessage-deflate
+
+- (void)testServerNegotiatesWindowBits {
+    PSWebSocketDeflateOptions *options = [[PSWebSocketDeflateOptions alloc] init];
+    options.windowBits = 11;
+    
+    // the client limit is only sent back when the client offered to take one
+    XCTAssertEqualObjects([self negotiatedExtensionsForOffer:@"permessage-deflate; client_max_window_bits" options:options],
+                          @"permessage-deflate; client_max_window_bits=11; server_max_window_bits=11");
+    XCTAssertEqualObjects([self negotiatedExtensionsForOffer:@"permessage-deflate" options:options],
+                          @"permessage-deflate; server_max_window_bits=11");
+    
+    // smaller windows asked for by the client win over our own
+    options.windowBits = 15;
+    XCTAssertEqualObjects([self negotiatedExtensionsForOffer:@"permessage-deflate; client_max_window_bits=10; server_max_window_bits=9" options:options],
+                          @"permessage-deflate; client_max_window_bits=10; server_max_window_bits=9");
+}
+
+- (void)testServerNegotiatesContextTakeover {
+    PSWebSocketDeflateOptions *options = [[PSWebSocketDeflateOptions alloc] init];
+    XCTAssertEqualObjects([self negotiatedExtensionsForOffer:@"permessage-deflate; client_no_context_takeover" options:options],
+                          @"permessage-deflate; server_max_window_bits=11; client_no_context_takeover");
+    options.noContextTakeover = YES;
+    XCTAssertEqualObjects([self negotiatedExtensionsForOffer:@"permessage-deflate" options:options],
+                          @"permessage-deflate; server_max_window_bits=11; server_no_context_takeover");
+}
+
+- (void)testServerDeclinesDeflate {
+    PSWebSocketDeflateOptions *options = [[PSWebSocketDeflateOptions alloc] init];
+    options.enabled = NO;
+    XCTAssertNil([self negotiatedExtensionsForOffer:@"permessage-deflate; client_max_window_bits" options:options]);
+    XCTAssertNil([self negotiatedExtensionsForOffer:nil options:[[PSWebSocketDeflateOptions alloc] init]]);
+    
+    // out of range parameters fail the handshake
+    _recorder = [[PSWebSocketDriverTestRecorder alloc] init];
+    PSWebSocketDriver *driver = [PSWebSocketDriver serverDriverWithRequest:PSWebSocketDriverTestRequest(@"permessage-deflate; server_max_window_bits=16")];
+    driver.delegate = _recorder;
+    [driver start];
+    XCTAssertNotNil(_recorder.error);
+}
+
+- (void)testClientOffer {
+    PSWebSocketDeflateOptions *options = [[PSWebSocketDeflateOptions alloc] init];
+    options.windowBits = 11;
+    options.noContextTakeover = YES;
+    [self openedClientDriverWithOptions:options responseExtensions:nil];
+    XCTAssertEqualObjects([self handshakeHeadersIsRequest:YES][@"Sec-WebSocket-Extensions"],
+                          @"permessage-deflate; client_max_window_bits; server_max_window_bits=11; client_no_context_takeover");
+}
+
+- (void)testClientUsesEachWindowForItsOwnDirection {
+    PSWebSocketDeflateOptions *options = [[PSWebSocketDeflateOptions alloc] init];
+    options.windowBits = 15;
+    PSWebSocketDriver *driver = [self openedClientDriverWithOptions:options responseExtensions:@"permessage-deflate; client_max_window_bits=9; server_max_window_bits=11"];
+    XCTAssertNil(_recorder.error);
+    
+    // what we send must fit the 9 bit window the server inflates with, so the
+    // repeat 1024 bytes back can't be referenced
+    NSData *noise = PSWebSocketDriverTestRepeatedNoise(1024);
+    [driver sendBinary:noise compression:PSWebSocketDriverCompressionAlways];
+    NSData *frame = _recorder.frames.lastObject;
+    XCTAssertTrue(((const uint8_t *)frame.bytes)[0] & PSWebSocketRsv1Mask);
+    XCTAssertEqualObjects(PSWebSocketDriverTestInflate(PSWebSocketDriverTestFramePayload(frame), 9), noise);
+    
+    // and what the server sends may use its full 11 bit window
+    NSData *deflated = PSWebSocketDriverTestDeflate(noise, 11);
+    XCTAssertNil(PSWebSocketDriverTestInflate(deflated, 9));
+    [self feed:PSWebSocketDriverTestFrame(PSWebSocketOpCodeBinary, YES, YES, deflated, NO) toDriver:driver];
+    XCTAssertNil(_recorder.error);
+    XCTAssertEqualObjects(_recorder.messages.lastObject, noise);
+}
+
+- (void)testClientRejectsUnofferedDeflate {
+    PSWebSocketDeflateOptions *options = [[PSWebSocketDeflateOptions alloc] init];
+    options.enabled = NO;
+    [self openedClientDriverWithOptions:options responseExtensions:@"permessage-deflate; server_max_window_bits=11"];
+    XCTAssertEqual(_recorder.error.code, PSWebSocketErrorCodeHandshakeFailed);
+}
+
+#pragma mark - Prepared Messages
+
+- (void)testPreparedMessageDeflatesOncePerWindow {
+    NSData *text = PSWebSocketDriverTestText(4000);
+    PSWebSocketPreparedMessage *message = [PSWebSocketPreparedMessage preparedMessageWithMessage:[[NSString alloc] initWithData:text encoding:NSUTF8StringEncoding]];
+    NSData *deflated11 = [message deflatedDataWithWindowBits:11];
+    NSData *deflated9 = [message deflatedDataWithWindowBits:9];
+    XCTAssertNotNil(deflated11);
+    XCTAssertTrue([message deflatedDataWithWindowBits:11] == deflated11);
+    XCTAssertTrue([message deflatedDataWithWindowBits:9] == deflated9);
+    XCTAssertFalse(deflated9 == deflated11);
+    XCTAssertEqualObjects(PSWebSocketDriverTestInflate(deflated11, 11), text);
+    XCTAssertEqualObjects(PSWebSocketDriverTestInflate(deflated9, 9), text);
+    
+    // every websocket with the same window gets the same payload
+    for(NSUInteger i = 0; i < 2; ++i) {
+        PSWebSocketDriver *driver = [self startedServerDriverWithExtensions:@"permessage-deflate"];
+        [driver sendPreparedMessage:message];
+        NSData *frame = _recorder.frames.lastObject;
+        XCTAssertTrue(((const uint8_t *)frame.bytes)[0] & PSWebSocketRsv1Mask);
+        XCTAssertEqualObjects(PSWebSocketDriverTestFramePayload(frame), deflated11);
+    }
+}
+
+- (void)testPreparedMessageResetsDeflaterWithContextTakeover {
+    NSString *text = [[NSString alloc] initWithData:PSWebSocketDriverTestText(2000) encoding:NSUTF8StringEncoding];
+    NSString *preparedText = [text uppercaseString];
+    PSWebSocketDriver *driver = [self startedServerDriverWithExtensions:@"permessage-deflate"];
+    [driver sendText:text compression:PSWebSocketDriverCompressionAlways];
+    [driver sendPreparedMessage:[PSWebSocketPreparedMessage preparedMessageWithMessage:preparedText]];
+    [driver sendText:text compression:PSWebSocketDriverCompressionAlways];
+    XCTAssertEqual(_recorder.frames.count, 3);
+    
+    // the message after the prepared one can't lean on history the peer never saw
+    NSData *first = PSWebSocketDriverTestFramePayload(_recorder.frames[0]);
+    NSData *last = PSWebSocketDriverTestFramePayload(_recorder.frames[2]);
+    XCTAssertEqualObjects(last, first);
+    
+    // and the peer, keeping its context across all three, reads them back
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    inflateInit2(&stream, -11);
+    NSArray *expected = @[text, preparedText, text];
+    const uint8_t trailer[4] = {0x00, 0x00, 0xff, 0xff};
+    for(NSUInteger i = 0; i < 3; ++i) {
+        NSMutableData *input = [PSWebSocketDriverTestFramePayload(_recorder.frames[i]) mutableCopy];
+        [input appendBytes:trailer length:sizeof(trailer)];
+        NSMutableData *inflated = [NSMutableData dataWithLength:64 * 1024];
+        stream.next_in = input.mutableBytes;
+        stream.avail_in = (uInt)input.length;
+        stream.next_out = inflated.mutableBytes;
+        stream.avail_out = (uInt)inflated.length;
+        XCTAssertEqual(inflate(&stream, Z_SYNC_FLUSH), Z_OK);
+        inflated.length -= stream.avail_out;
+        XCTAssertEqualObjects([[NSString alloc] initWithData:inflated encoding:NSUTF8StringEncoding], expected[i]);
+    }
+    inflateEnd(&stream);
+}
+
+@end
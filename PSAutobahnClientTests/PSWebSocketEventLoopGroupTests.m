@@ -0,0 +1,86 @@
+//  Copyright 2014 Zwopple Limited
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#import <XCTest/XCTest.h>
+#import "PSWebSocketEventLoopGroup.h"
+
+@interface PSWebSocketEventLoopGroupTests : XCTestCase
+
+@end
+@implementation PSWebSocketEventLoopGroupTests
+
+- (void)testThreads {
+    PSWebSocketEventLoopGroup *group = [[PSWebSocketEventLoopGroup alloc] initWithThreadCount:3];
+    XCTAssertEqual(group.threadCount, 3);
+    XCTAssertEqual([NSSet setWithArray:group.runLoops].count, 3);
+    XCTAssertEqual(group.connectionCount, 0);
+    
+    XCTAssertEqual([PSWebSocketEventLoopGroup defaultGroup].threadCount, 1);
+    XCTAssertEqual([PSWebSocketEventLoopGroup defaultGroup], [PSWebSocketEventLoopGroup defaultGroup]);
+}
+
+- (void)testRoundRobinPlacement {
+    PSWebSocketEventLoopGroup *group = [[PSWebSocketEventLoopGroup alloc] initWithThreadCount:3];
+    group.placement = PSWebSocketEventLoopPlacementRoundRobin;
+    NSArray *runLoops = group.runLoops;
+    
+    // in turn, whatever each thread already holds
+    [group acquireRunLoop:runLoops[0]];
+    NSMutableArray *acquired = [NSMutableArray array];
+    for(NSUInteger i = 0; i < 6; ++i) {
+        [acquired addObject:[group acquireRunLoop]];
+        XCTAssertEqual(acquired.lastObject, runLoops[i % 3]);
+    }
+    XCTAssertEqual(group.connectionCount, 7);
+    
+    for(NSRunLoop *runLoop in acquired) {
+        [group releaseRunLoop:runLoop];
+    }
+    [group releaseRunLoop:runLoops[0]];
+    XCTAssertEqual(group.connectionCount, 0);
+}
+
+- (void)testLeastLoadedPlacement {
+    PSWebSocketEventLoopGroup *group = [[PSWebSocketEventLoopGroup alloc] initWithThreadCount:3];
+    XCTAssertEqual(group.placement, PSWebSocketEventLoopPlacementLeastLoaded);
+    NSArray *runLoops = group.runLoops;
+    
+    // spread evenly, ties going to the first thread
+    XCTAssertEqual([group acquireRunLoop], runLoops[0]);
+    XCTAssertEqual([group acquireRunLoop], runLoops[1]);
+    XCTAssertEqual([group acquireRunLoop], runLoops[2]);
+    
+    // a released slot is filled first
+    [group releaseRunLoop:runLoops[1]];
+    XCTAssertEqual([group acquireRunLoop], runLoops[1]);
+    
+    // connections placed on a particular thread count towards its load too
+    [group acquireRunLoop:runLoops[0]];
+    [group acquireRunLoop:runLoops[0]];
+    XCTAssertEqual([group acquireRunLoop], runLoops[1]);
+    XCTAssertEqual([group acquireRunLoop], runLoops[2]);
+    XCTAssertEqual([group acquireRunLoop], runLoops[1]);
+    XCTAssertEqual(group.connectionCount, 8);
+    
+    // 3 / 3 / 2
+    XCTAssertEqual([group acquireRunLoop], runLoops[2]);
+    for(NSUInteger i = 0; i < 3; ++i) {
+        for(NSRunLoop *runLoop in runLoops) {
+            [group releaseRunLoop:runLoop];
+        }
+    }
+    XCTAssertEqual(group.connectionCount, 0);
+}
+
+@end
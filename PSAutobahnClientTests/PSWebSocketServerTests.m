@@ -0,0 +1,193 @@
+//  Copyright 2014 Zwopple Limited
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#import <XCTest/XCTest.h>
+#import "PSWebSocketServer.h"
+#import "PSWebSocket.h"
+#import "PSWebSocketDeflateOptions.h"
+
+@interface PSWebSocketServer (PSWebSocketServerTests)
+
+- (void)executeWorkAndWait:(void (^)(void))work;
+- (void)attachWebSocket:(PSWebSocket *)webSocket;
+- (void)webSocket:(PSWebSocket *)webSocket didCloseWithCode:(NSInteger)code reason:(NSString *)reason wasClean:(BOOL)wasClean;
+- (PSWebSocketDeflateOptions *)deflateOptionsForRequest:(NSURLRequest *)request memoryCost:(NSUInteger *)outCost;
+
+@end
+
+static NSURLRequest *PSWebSocketServerTestRequest(NSString *extensions) {
+    NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:[NSURL URLWithString:@"ws://localhost/"]];
+    if(extensions) {
+        [request setValue:extensions forHTTPHeaderField:@"Sec-WebSocket-Extensions"];
+    }
+    return request;
+}
+
+@interface PSWebSocketServerTests : XCTestCase {
+    PSWebSocketServer *_server;
+}
+
+@end
+@implementation PSWebSocketServerTests
+
+- (void)setUp {
+    [super setUp];
+    _server = [PSWebSocketServer serverWithHost:nil port:9001];
+    PSWebSocketDeflateOptions *options = [[PSWebSocketDeflateOptions alloc] init];
+    options.windowBits = 15;
+    options.memoryLevel = 8;
+    _server.deflateOptions = options;
+}
+
+#pragma mark - Compression Memory
+
+- (PSWebSocketDeflateOptions *)optionsForOffer:(NSString *)offer budget:(NSUInteger)budget cost:(NSUInteger *)outCost {
+    _server.compressionMemoryBudget = budget;
+    return [_server deflateOptionsForRequest:PSWebSocketServerTestRequest(offer) memoryCost:outCost];
+}
+
+- (void)testBudgetDegradesWindowThenMemoryLevelThenContextTakeover {
+    NSString *offer = @"permessage-deflate; client_max_window_bits";
+    NSUInteger cost = 0;
+    
+    // inflate 7168 + 2^15, deflate 6144 + 2^17 + 2^17
+    PSWebSocketDeflateOptions *options = [self optionsForOffer:offer budget:0 cost:&cost];
+    XCTAssertTrue(options.enabled);
+    XCTAssertEqual(options.windowBits, 15);
+    XCTAssertEqual(cost, 308224);
+    options = [self optionsForOffer:offer budget:308224 cost:&cost];
+    XCTAssertEqual(options.windowBits, 15);
+    XCTAssertEqual(cost, 308224);
+    
+    // the window shrinks first
+    options = [self optionsForOffer:offer budget:170000 cost:&cost];
+    XCTAssertEqual(options.windowBits, 12);
+    XCTAssertEqual(options.memoryLevel, 8);
+    XCTAssertEqual(cost, 164864);
+    
+    // then the memory level once the window is down to 9
+    options = [self optionsForOffer:offer budget:20000 cost:&cost];
+    XCTAssertEqual(options.windowBits, 9);
+    XCTAssertEqual(options.memoryLevel, 3);
+    XCTAssertFalse(options.noContextTakeover);
+    XCTAssertEqual(cost, 19968);
+    
+    // then only the inflater is charged without deflate history
+    options = [self optionsForOffer:offer budget:10000 cost:&cost];
+    XCTAssertTrue(options.enabled);
+    XCTAssertEqual(options.windowBits, 9);
+    XCTAssertEqual(options.memoryLevel, 1);
+    XCTAssertTrue(options.noContextTakeover);
+    XCTAssertEqual(cost, 7680);
+    
+    // and finally compression is declined
+    options = [self optionsForOffer:offer budget:5000 cost:&cost];
+    XCTAssertFalse(options.enabled);
+    XCTAssertEqual(cost, 0);
+}
+
+- (void)testBudgetChargesNegotiatedWindows {
+    NSUInteger cost = 0;
+    
+    // windows the client asks for are charged instead of our own
+    [self optionsForOffer:@"permessage-deflate; client_max_window_bits=10; server_max_window_bits=10" budget:0 cost:&cost];
+    XCTAssertEqual(cost, (7168 + 1024) + (6144 + 4096 + 131072));
+    
+    // a client that can't be limited inflates with a full window whatever we configure
+    PSWebSocketDeflateOptions *options = [self optionsForOffer:@"permessage-deflate" budget:170000 cost:&cost];
+    XCTAssertEqual(options.windowBits, 9);
+    XCTAssertEqual(options.memoryLevel, 7);
+    XCTAssertEqual(cost, (7168 + 32768) + (6144 + 2048 + 65536));
+}
+
+- (void)testBudgetIgnoresRequestsWithoutCompression {
+    NSUInteger cost = 1;
+    PSWebSocketDeflateOptions *options = [self optionsForOffer:nil budget:1 cost:&cost];
+    XCTAssertTrue(options.enabled);
+    XCTAssertEqual(cost, 0);
+    
+    // the driver declines windows zlib can't produce so nothing is charged
+    cost = 1;
+    [self optionsForOffer:@"permessage-deflate; server_max_window_bits=8" budget:1 cost:&cost];
+    XCTAssertEqual(cost, 0);
+}
+
+#pragma mark - Topics
+
+- (PSWebSocket *)attachedWebSocket {
+    PSWebSocket *webSocket = [PSWebSocket serverSocketWithRequest:PSWebSocketServerTestRequest(nil) inputStream:nil outputStream:nil];
+    [_server executeWorkAndWait:^{
+        [_server attachWebSocket:webSocket];
+    }];
+    return webSocket;
+}
+- (NSUInteger)subscribedWebSocketCount {
+    __block NSUInteger count = 0;
+    [_server executeWorkAndWait:^{
+        count = [[_server valueForKey:@"topicsByWebSocket"] count];
+    }];
+    return count;
+}
+
+- (void)testSubscribeAndUnsubscribe {
+    PSWebSocket *a = [self attachedWebSocket];
+    PSWebSocket *b = [self attachedWebSocket];
+    [_server subscribeWebSocket:a toTopic:@"news"];
+    [_server subscribeWebSocket:b toTopic:@"news"];
+    [_server subscribeWebSocket:a toTopic:@"sports"];
+    [_server subscribeWebSocket:a toTopic:@"news"];
+    XCTAssertEqual([_server subscriberCountForTopic:@"news"], 2);
+    XCTAssertEqual([_server subscriberCountForTopic:@"sports"], 1);
+    XCTAssertEqual([self subscribedWebSocketCount], 2);
+    
+    // unsubscribing twice or from a topic never joined changes nothing
+    [_server unsubscribeWebSocket:b fromTopic:@"news"];
+    [_server unsubscribeWebSocket:b fromTopic:@"news"];
+    [_server unsubscribeWebSocket:b fromTopic:@"sports"];
+    XCTAssertEqual([_server subscriberCountForTopic:@"news"], 1);
+    XCTAssertEqual([_server subscriberCountForTopic:@"sports"], 1);
+    XCTAssertEqual([self subscribedWebSocketCount], 1);
+    
+    [_server unsubscribeWebSocket:a fromTopic:@"news"];
+    [_server unsubscribeWebSocket:a fromTopic:@"sports"];
+    XCTAssertEqual([_server subscriberCountForTopic:@"news"], 0);
+    XCTAssertEqual([_server subscriberCountForTopic:@"sports"], 0);
+    XCTAssertEqual([self subscribedWebSocketCount], 0);
+}
+
+- (void)testClosedWebSocketsLeaveEveryTopic {
+    PSWebSocket *a = [self attachedWebSocket];
+    PSWebSocket *b = [self attachedWebSocket];
+    [_server subscribeWebSocket:a toTopic:@"news"];
+    [_server subscribeWebSocket:a toTopic:@"sports"];
+    [_server subscribeWebSocket:b toTopic:@"news"];
+    
+    [_server webSocket:a didCloseWithCode:1000 reason:nil wasClean:YES];
+    XCTAssertEqual([_server subscriberCountForTopic:@"news"], 1);
+    XCTAssertEqual([_server subscriberCountForTopic:@"sports"], 0);
+    XCTAssertEqual([self subscribedWebSocketCount], 1);
+    
+    // nor can they, or websockets the server never accepted, join again
+    PSWebSocket *stranger = [PSWebSocket serverSocketWithRequest:PSWebSocketServerTestRequest(nil) inputStream:nil outputStream:nil];
+    [_server subscribeWebSocket:a toTopic:@"news"];
+    [_server subscribeWebSocket:stranger toTopic:@"news"];
+    XCTAssertEqual([_server subscriberCountForTopic:@"news"], 1);
+    XCTAssertEqual([self subscribedWebSocketCount], 1);
+    
+    [_server webSocket:b didCloseWithCode:1000 reason:nil wasClean:YES];
+    XCTAssertEqual([_server subscriberCountForTopic:@"news"], 0);
+    XCTAssertEqual([self subscribedWebSocketCount], 0);
+}
+
+@end
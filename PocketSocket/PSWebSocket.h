@@ -14,6 +14,10 @@
 
 #import <Foundation/Foundation.h>
 #import "PSWebSocketTypes.h"
+#import "PSWebSocketCompressionPolicy.h"
+#import "PSWebSocketDeflateOptions.h"
+#import "PSWebSocketPreparedMessage.h"
+#import "PSWebSocketEventLoopGroup.h"
 
 typedef struct PSWebSocketByteCount
 {
@@ -31,6 +35,16 @@ typedef NS_ENUM(NSInteger, PSWebSocketReadyState) {
     PSWebSocketReadyStateClosed
 };
 
+/**
+ *  Produces the next fragment of a streamed message.
+ *
+ *  @param maxLength the websocket's fragmentSize, the most bytes that should be returned
+ *  @param outError  set to abort the message, the websocket is then closed with 1011
+ *
+ *  @return the next bytes of the message or nil once the message is complete
+ */
+typedef NSData *(^PSWebSocketFragmentProducer)(NSUInteger maxLength, NSError *__autoreleasing *outError);
+
 @class PSWebSocket;
 
 /**
@@ -47,6 +61,58 @@ typedef NS_ENUM(NSInteger, PSWebSocketReadyState) {
 @optional
 - (BOOL)webSocket:(PSWebSocket *)webSocket shouldTrustServer:(SecTrustRef)serverTrust;
 
+/**
+ *  Called instead of webSocket:didReceiveMessage: for text messages when implemented.
+ *  The data holds the already validated UTF-8 bytes of the message so no NSString is
+ *  created, avoiding a second copy and validation pass of the payload.
+ *
+ *  @param webSocket websocket the message was received on
+ *  @param message   UTF-8 bytes of the text message
+ */
+- (void)webSocket:(PSWebSocket *)webSocket didReceiveUTF8Message:(NSData *)message;
+
+/**
+ *  Called when a data message starts arriving. Only sent when the delegate implements
+ *  webSocket:didReceiveMessageChunk: at the time it is set.
+ *
+ *  @param webSocket websocket the message is being received on
+ *  @param binary    YES for a binary message, NO for a text message
+ */
+- (void)webSocket:(PSWebSocket *)webSocket didBeginMessage:(BOOL)binary;
+
+/**
+ *  When implemented every data message is delivered in chunks as it arrives instead of
+ *  through webSocket:didReceiveMessage:, so memory use is bounded by the chunk size rather
+ *  than the message size. Chunks are already inflated and text chunks have been checked
+ *  as valid UTF-8 so far, although a multi byte sequence may be split across two chunks.
+ *
+ *  @param webSocket websocket the message is being received on
+ *  @param chunk     next bytes of the message
+ */
+- (void)webSocket:(PSWebSocket *)webSocket didReceiveMessageChunk:(NSData *)chunk;
+
+/**
+ *  Called once the final chunk of a message has been delivered
+ *
+ *  @param webSocket websocket the message was received on
+ */
+- (void)webSocketDidEndMessage:(PSWebSocket *)webSocket;
+
+/**
+ *  Called once bufferedAmount reaches highWatermark. Producers should hold off
+ *  sending until webSocketDidDrainToLowWatermark: is called.
+ *
+ *  @param webSocket websocket whose output is backing up
+ */
+- (void)webSocketDidReachHighWatermark:(PSWebSocket *)webSocket;
+
+/**
+ *  Called once bufferedAmount drains back down to lowWatermark after reaching highWatermark
+ *
+ *  @param webSocket websocket whose output has drained
+ */
+- (void)webSocketDidDrainToLowWatermark:(PSWebSocket *)webSocket;
+
 @end
 
 /**
@@ -73,6 +139,87 @@ typedef NS_ENUM(NSInteger, PSWebSocketReadyState) {
 @property (nonatomic, assign, readonly) PSWebSocketByteCount bytesSent;
 @property (nonatomic, assign, readonly) PSWebSocketByteCount bytesReceived;
 
+/**
+ *  Maximum number of payload bytes read into each frame of a streamed message,
+ *  captured when the stream is sent. Defaults to 64KB.
+ */
+@property (nonatomic, assign) NSUInteger fragmentSize;
+
+/**
+ *  Decides which messages sent with send: are worth compressing when permessage-deflate
+ *  is in use and keeps statistics on the results. Set to nil to compress every message.
+ */
+@property (nonatomic, strong) PSWebSocketCompressionPolicy *compressionPolicy;
+
+/**
+ *  zlib settings offered and used for permessage-deflate. Copied, and only read when the
+ *  handshake is sent or answered so it must be set before opening. Defaults to balancedOptions.
+ */
+@property (nonatomic, copy) PSWebSocketDeflateOptions *deflateOptions;
+
+/**
+ *  Seconds without traffic after which zlib state is freed, to be set up again when
+ *  the next compressed message needs it. The peer's history is only freed when it
+ *  agreed to no context takeover. 0 keeps it for the life of the connection.
+ *  Defaults to 30.
+ */
+@property (nonatomic, assign) NSTimeInterval compressionIdleInterval;
+
+/**
+ *  Network threads the websocket's streams are scheduled on, one of which is picked
+ *  when it opens. Must be set before opening. Defaults to the default group.
+ */
+@property (nonatomic, strong) PSWebSocketEventLoopGroup *eventLoopGroup;
+
+/**
+ *  Number of bytes queued to be written to the socket. Reading this never waits on
+ *  the websocket's queue so it is safe to poll from a producer.
+ */
+@property (atomic, assign, readonly) NSUInteger bufferedAmount;
+
+/**
+ *  bufferedAmount at which webSocketDidReachHighWatermark: is called. Defaults to 0, disabled.
+ */
+@property (nonatomic, assign) NSUInteger highWatermark;
+
+/**
+ *  bufferedAmount at which webSocketDidDrainToLowWatermark: is called after the high
+ *  watermark was reached. Defaults to 0.
+ */
+@property (nonatomic, assign) NSUInteger lowWatermark;
+
+/**
+ *  Stop reading from the socket once this many received messages are waiting to be
+ *  delivered on the delegate queue, resuming as the delegate catches up. Chunks
+ *  delivered with webSocket:didReceiveMessageChunk: count as messages. Defaults to 0,
+ *  no limit.
+ */
+@property (nonatomic, assign) NSUInteger maxUndeliveredMessages;
+
+/**
+ *  Upper bound on how many bytes are read from the socket at once. Reads start small
+ *  and grow towards this while the socket keeps filling them. Defaults to 256KB.
+ */
+@property (nonatomic, assign) NSUInteger maxReadLength;
+
+/**
+ *  Largest frame payload accepted from the peer, checked as soon as the frame header
+ *  is parsed. Larger frames close the connection with 1009. Defaults to 0, no limit.
+ */
+@property (nonatomic, assign) NSUInteger maxFrameLength;
+
+/**
+ *  Largest message accepted from the peer counting the payload of every fragment as it
+ *  arrives on the wire. Larger messages close the connection with 1009. Defaults to 0, no limit.
+ */
+@property (nonatomic, assign) NSUInteger maxMessageLength;
+
+/**
+ *  Largest size a compressed message may inflate to. Inflating stops and the connection
+ *  is closed with 1009 as soon as it is crossed. Defaults to 0, no limit.
+ */
+@property (nonatomic, assign) NSUInteger maxInflatedMessageLength;
+
 #pragma mark - Initialization
 
 /**
@@ -110,10 +257,83 @@ typedef NS_ENUM(NSInteger, PSWebSocketReadyState) {
 /**
  *  Send a message over the websocket
  *
- *  @param message an instance of NSData or NSString to send
+ *  @param message an instance of NSData, NSString or PSWebSocketPreparedMessage to send
  */
 - (void)send:(id)message;
 
+/**
+ *  Send a message over the websocket overriding the compression policy
+ *
+ *  @param message  an instance of NSData or NSString to send
+ *  @param compress whether to deflate the message, only has an effect when
+ *                  permessage-deflate was negotiated
+ */
+- (void)send:(id)message compress:(BOOL)compress;
+
+/**
+ *  Send several messages at once. Every frame is encoded before anything is
+ *  written so the whole batch goes out in as few writes as possible.
+ *
+ *  @param messages an array of NSData, NSString and/or PSWebSocketPreparedMessage
+ *                  instances to send in order
+ */
+- (void)sendMessages:(NSArray *)messages;
+
+/**
+ *  Hold back writing to the socket until the matching endBatch so that messages
+ *  sent in between are flushed together. Batches may be nested, output resumes
+ *  when the outermost batch ends or the websocket closes.
+ */
+- (void)beginBatch;
+
+/**
+ *  End a batch started with beginBatch and flush everything sent during it
+ */
+- (void)endBatch;
+
+/**
+ *  Send a message read from a stream as a series of fragments without holding
+ *  the whole payload in memory. The next fragment is only read once the previous
+ *  one has mostly drained to the socket. Messages sent while a stream is in
+ *  progress are queued behind it, pings and close are not.
+ *
+ *  @param stream     unopened or opened stream to read the message from, it is read
+ *                    synchronously so it should be backed by a file or memory
+ *  @param binary     whether to send a binary or text message, text must be UTF-8
+ *  @param completion optional callback on the delegate queue once the final
+ *                    fragment is queued or with an error if the message was aborted
+ */
+- (void)sendStream:(NSInputStream *)stream binary:(BOOL)binary completion:(void (^)(NSError *error))completion;
+
+/**
+ *  Send the contents of a file as a streamed message, see sendStream:binary:completion:
+ *
+ *  @param fileURL    file to send
+ *  @param binary     whether to send a binary or text message
+ *  @param completion optional callback on the delegate queue once the message is queued
+ */
+- (void)sendFileAtURL:(NSURL *)fileURL binary:(BOOL)binary completion:(void (^)(NSError *error))completion;
+
+/**
+ *  Send a message as a series of fragments pulled from a block, see sendStream:binary:completion:
+ *
+ *  @param producer   block called on the websocket's queue for each fragment
+ *  @param binary     whether to send a binary or text message
+ *  @param completion optional callback on the delegate queue once the message is queued
+ */
+- (void)sendFragmentsFromProducer:(PSWebSocketFragmentProducer)producer binary:(BOOL)binary completion:(void (^)(NSError *error))completion;
+
+/**
+ *  Stop reading from the socket so the peer is slowed down by TCP flow control.
+ *  Messages already read may still be delivered.
+ */
+- (void)pauseReading;
+
+/**
+ *  Resume reading from the socket after pauseReading
+ */
+- (void)resumeReading;
+
 /**
  *  Send a ping over the websocket
  *
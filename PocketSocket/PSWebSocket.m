@@ -17,6 +17,20 @@
 #import "PSWebSocketInternal.h"
 #import "PSWebSocketDriver.h"
 #import "PSWebSocketBuffer.h"
+#import <sys/socket.h>
+#import <fcntl.h>
+#import <unistd.h>
+#import <errno.h>
+
+// maximum number of queued segments gathered into one writev
+static const NSUInteger PSWebSocketMaxWriteIOVecs = 64;
+
+// bounds of the adaptive input read length
+static const NSUInteger PSWebSocketMinReadLength = 4096;
+static const NSUInteger PSWebSocketDefaultMaxReadLength = 256 * 1024;
+
+// default payload length of each frame of a streamed message
+static const NSUInteger PSWebSocketDefaultFragmentSize = 64 * 1024;
 
 void PSWebSocketAddBytesToByteCount(uint64_t bytes, PSWebSocketByteCount *byteCount) {
 	uint64_t remaining = ULONG_LONG_MAX - byteCount->bytes;
@@ -31,6 +45,44 @@ void PSWebSocketAddBytesToByteCount(uint64_t bytes, PSWebSocketByteCount *byteCo
 	}
 };
 
+// we write behind any stream's back so never block and never raise SIGPIPE
+static void PSWebSocketConfigureNativeSocket(CFSocketNativeHandle handle) {
+    int yes = 1;
+    setsockopt(handle, SOL_SOCKET, SO_NOSIGPIPE, &yes, sizeof(yes));
+    fcntl(handle, F_SETFL, fcntl(handle, F_GETFL, 0) | O_NONBLOCK);
+}
+
+// payloads are queued by reference, copying is free for immutable data and keeps
+// mutable data from changing underneath the queue
+static id PSWebSocketCopyMessage(id message) {
+    if([message isKindOfClass:[NSData class]] || [message isKindOfClass:[NSString class]]) {
+        return [message copy];
+    }
+    return message;
+}
+
+@interface PSWebSocketStreamedMessage : NSObject
+
+@property (nonatomic, copy) PSWebSocketFragmentProducer producer;
+@property (nonatomic, copy) void (^completion)(NSError *error);
+@property (nonatomic, assign) BOOL binary;
+@property (nonatomic, assign) NSUInteger fragmentSize;
+
+@end
+@implementation PSWebSocketStreamedMessage
+
+@end
+
+@interface PSWebSocketOutgoingMessage : NSObject
+
+@property (nonatomic, strong) id message;
+@property (nonatomic, assign) PSWebSocketDriverCompression compression;
+
+@end
+@implementation PSWebSocketOutgoingMessage
+
+@end
+
 @interface PSWebSocket() <NSStreamDelegate, PSWebSocketDriverDelegate> {
     PSWebSocketMode _mode;
     NSMutableURLRequest *_request;
@@ -38,8 +90,16 @@ void PSWebSocketAddBytesToByteCount(uint64_t bytes, PSWebSocketByteCount *byteCo
     PSWebSocketDriver *_driver;
     PSWebSocketBuffer *_inputBuffer;
     PSWebSocketBuffer *_outputBuffer;
+    NSUInteger _readLength;
     NSInputStream *_inputStream;
     NSOutputStream *_outputStream;
+    CFSocketNativeHandle _nativeSocket;
+    BOOL _usesDispatchSources;
+    dispatch_source_t _readSource;
+    dispatch_source_t _writeSource;
+    dispatch_group_t _sourceGroup;
+    BOOL _readSourceSuspended;
+    BOOL _writeSourceSuspended;
     PSWebSocketReadyState _readyState;
     BOOL _secure;
 	BOOL _securityChecked;
@@ -49,6 +109,18 @@ void PSWebSocketAddBytesToByteCount(uint64_t bytes, PSWebSocketByteCount *byteCo
     BOOL _failed;
     BOOL _pumpingInput;
     BOOL _pumpingOutput;
+    NSUInteger _batchDepth;
+    PSWebSocketStreamedMessage *_streamedMessage;
+    NSMutableArray *_pendingMessages;
+    BOOL _pumpingStreamedMessage;
+    BOOL _aboveHighWatermark;
+    BOOL _readingPaused;
+    NSUInteger _undeliveredMessages;
+    NSRunLoop *_runLoop;
+    NSMutableArray *_preparedMessageInbox;
+    BOOL _preparedMessageDrainScheduled;
+    CFAbsoluteTime _compressionActivityTime;
+    BOOL _compressionIdleCheckScheduled;
     NSInteger _closeCode;
     NSString *_closeReason;
     NSMutableArray *_pingHandlers;
@@ -67,6 +139,9 @@ void PSWebSocketAddBytesToByteCount(uint64_t bytes, PSWebSocketByteCount *byteCo
 	PSWebSocketByteCount _bytesSent;
 	PSWebSocketByteCount _bytesReceived;
 }
+
+@property (atomic, assign, readwrite) NSUInteger bufferedAmount;
+
 @end
 @implementation PSWebSocket
 
@@ -88,6 +163,53 @@ void PSWebSocketAddBytesToByteCount(uint64_t bytes, PSWebSocketByteCount *byteCo
 @dynamic bytesSent;
 @dynamic bytesReceived;
 
+- (void)setDelegate:(id <PSWebSocketDelegate>)delegate {
+    _delegate = delegate;
+    BOOL deliversMessageChunks = [delegate respondsToSelector:@selector(webSocket:didReceiveMessageChunk:)];
+    [self executeWork:^{
+        _driver.deliversMessageChunks = deliversMessageChunks;
+    }];
+}
+- (void)setCompressionPolicy:(PSWebSocketCompressionPolicy *)compressionPolicy {
+    _compressionPolicy = compressionPolicy;
+    [self executeWork:^{
+        _driver.compressionPolicy = compressionPolicy;
+    }];
+}
+- (void)setDeflateOptions:(PSWebSocketDeflateOptions *)deflateOptions {
+    _deflateOptions = [deflateOptions copy];
+    PSWebSocketDeflateOptions *options = _deflateOptions;
+    [self executeWork:^{
+        _driver.deflateOptions = options;
+    }];
+}
+- (void)setEventLoopGroup:(PSWebSocketEventLoopGroup *)eventLoopGroup {
+    [self executeWorkAndWait:^{
+        if(_opened || _readyState != PSWebSocketReadyStateConnecting) {
+            [NSException raise:@"Invalid State" format:@"You cannot set the event loop group on a PSWebSocket once it is opened."];
+            return;
+        }
+        _eventLoopGroup = (eventLoopGroup) ? eventLoopGroup : [PSWebSocketEventLoopGroup defaultGroup];
+    }];
+}
+- (void)setMaxFrameLength:(NSUInteger)maxFrameLength {
+    _maxFrameLength = maxFrameLength;
+    [self executeWork:^{
+        _driver.maxFrameLength = maxFrameLength;
+    }];
+}
+- (void)setMaxMessageLength:(NSUInteger)maxMessageLength {
+    _maxMessageLength = maxMessageLength;
+    [self executeWork:^{
+        _driver.maxMessageLength = maxMessageLength;
+    }];
+}
+- (void)setMaxInflatedMessageLength:(NSUInteger)maxInflatedMessageLength {
+    _maxInflatedMessageLength = maxInflatedMessageLength;
+    [self executeWork:^{
+        _driver.maxInflatedMessageLength = maxInflatedMessageLength;
+    }];
+}
 - (PSWebSocketReadyState)readyState {
     __block PSWebSocketReadyState value = 0;
     [self executeWorkAndWait:^{
@@ -131,6 +253,9 @@ void PSWebSocketAddBytesToByteCount(uint64_t bytes, PSWebSocketByteCount *byteCo
             _driver = [PSWebSocketDriver serverDriverWithRequest:_request];
         }
         _driver.delegate = self;
+        _compressionPolicy = [[PSWebSocketCompressionPolicy alloc] init];
+        _driver.compressionPolicy = _compressionPolicy;
+        _deflateOptions = [[PSWebSocketDeflateOptions alloc] init];
         _secure = ([_request.URL.scheme hasPrefix:@"https"] || [_request.URL.scheme hasPrefix:@"wss"]);
         _opened = NO;
         _closeWhenFinishedOutput = NO;
@@ -138,10 +263,27 @@ void PSWebSocketAddBytesToByteCount(uint64_t bytes, PSWebSocketByteCount *byteCo
         _failed = NO;
         _pumpingInput = NO;
         _pumpingOutput = NO;
+        _batchDepth = 0;
+        _pendingMessages = [NSMutableArray array];
+        _pumpingStreamedMessage = NO;
+        _aboveHighWatermark = NO;
+        _readingPaused = NO;
+        _undeliveredMessages = 0;
+        _eventLoopGroup = [PSWebSocketEventLoopGroup defaultGroup];
+        _preparedMessageInbox = [NSMutableArray array];
+        _preparedMessageDrainScheduled = NO;
+        _compressionIdleInterval = PSWebSocketDefaultCompressionIdleInterval;
+        _compressionActivityTime = 0;
+        _compressionIdleCheckScheduled = NO;
+        _fragmentSize = PSWebSocketDefaultFragmentSize;
         _closeCode = 0;
         _closeReason = nil;
         _pingHandlers = [NSMutableArray array];
+        _nativeSocket = -1;
         _inputBuffer = [[PSWebSocketBuffer alloc] init];
+        _readLength = PSWebSocketMinReadLength;
+        _maxReadLength = PSWebSocketDefaultMaxReadLength;
+        _inputBuffer.segmentLength = _readLength;
         _outputBuffer = [[PSWebSocketBuffer alloc] init];
         if(_request.HTTPBody.length > 0) {
             [_inputBuffer appendData:_request.HTTPBody];
@@ -213,6 +355,19 @@ void PSWebSocketAddBytesToByteCount(uint64_t bytes, PSWebSocketByteCount *byteCo
     }
     return self;
 }
++ (instancetype)serverSocketWithRequest:(NSURLRequest *)request nativeSocket:(CFSocketNativeHandle)nativeSocket {
+    return [[self alloc] initServerWithRequest:request nativeSocket:nativeSocket];
+}
+- (instancetype)initServerWithRequest:(NSURLRequest *)request nativeSocket:(CFSocketNativeHandle)nativeSocket {
+    // a plain socket handed over without streams, watched with dispatch sources and
+    // closed by the websocket itself
+    if((self = [self initWithMode:PSWebSocketModeServer request:request])) {
+        PSWebSocketConfigureNativeSocket(nativeSocket);
+        _nativeSocket = nativeSocket;
+        _usesDispatchSources = YES;
+    }
+    return self;
+}
 
 #pragma mark - Actions
 
@@ -237,14 +392,178 @@ void PSWebSocketAddBytesToByteCount(uint64_t bytes, PSWebSocketByteCount *byteCo
 }
 - (void)send:(id)message {
     NSParameterAssert(message);
+    if([message isKindOfClass:[PSWebSocketPreparedMessage class]]) {
+        [self enqueuePreparedMessage:message];
+        return;
+    }
+    message = PSWebSocketCopyMessage(message);
     [self executeWork:^{
-        if([message isKindOfClass:[NSString class]]) {
-            [_driver sendText:message];
-        } else if([message isKindOfClass:[NSData class]]) {
-            [_driver sendBinary:message];
-        } else {
-            [NSException raise:@"Invalid Message" format:@"Messages must be instances of NSString or NSData"];
+        [self sendMessage:message];
+    }];
+}
+- (void)send:(id)message compress:(BOOL)compress {
+    NSParameterAssert(message);
+    message = PSWebSocketCopyMessage(message);
+    PSWebSocketDriverCompression compression = (compress) ? PSWebSocketDriverCompressionAlways : PSWebSocketDriverCompressionNever;
+    [self executeWork:^{
+        [self sendMessage:message compression:compression];
+    }];
+}
+- (void)sendMessages:(NSArray *)messages {
+    NSParameterAssert(messages);
+    NSMutableArray *copiedMessages = [NSMutableArray arrayWithCapacity:messages.count];
+    for(id message in messages) {
+        [copiedMessages addObject:PSWebSocketCopyMessage(message)];
+    }
+    messages = copiedMessages;
+    [self executeWork:^{
+        ++_batchDepth;
+        for(id message in messages) {
+            [self sendMessage:message];
+        }
+        --_batchDepth;
+        [self pumpOutput];
+    }];
+}
+- (void)beginBatch {
+    [self executeWork:^{
+        ++_batchDepth;
+    }];
+}
+- (void)endBatch {
+    [self executeWork:^{
+        if(_batchDepth == 0) {
+            [NSException raise:@"Invalid State" format:@"endBatch called without a matching beginBatch"];
+            return;
+        }
+        if(--_batchDepth == 0) {
+            [self pumpOutput];
+        }
+    }];
+}
+- (void)sendStream:(NSInputStream *)stream binary:(BOOL)binary completion:(void (^)(NSError *error))completion {
+    NSParameterAssert(stream);
+    PSWebSocketFragmentProducer producer = ^NSData *(NSUInteger maxLength, NSError *__autoreleasing *outError) {
+        if(stream.streamStatus == NSStreamStatusNotOpen) {
+            [stream open];
+        }
+        
+        // read into a buffer the frame can reference without another copy
+        uint8_t *bytes = malloc(maxLength);
+        NSInteger readLength = [stream read:bytes maxLength:maxLength];
+        if(readLength <= 0) {
+            free(bytes);
+            if(readLength < 0 && outError) {
+                *outError = stream.streamError ?: [NSError errorWithDomain:PSWebSocketErrorDomain code:PSWebSocketErrorCodeUnknown userInfo:@{NSLocalizedDescriptionKey: @"Failed to read from message stream"}];
+            }
+            return nil;
+        }
+        return [NSData dataWithBytesNoCopy:bytes length:readLength freeWhenDone:YES];
+    };
+    [self sendFragmentsFromProducer:producer binary:binary completion:^(NSError *error) {
+        [stream close];
+        if(completion) {
+            completion(error);
+        }
+    }];
+}
+- (void)sendFileAtURL:(NSURL *)fileURL binary:(BOOL)binary completion:(void (^)(NSError *error))completion {
+    NSParameterAssert(fileURL);
+    [self sendStream:[NSInputStream inputStreamWithURL:fileURL] binary:binary completion:completion];
+}
+- (void)sendFragmentsFromProducer:(PSWebSocketFragmentProducer)producer binary:(BOOL)binary completion:(void (^)(NSError *error))completion {
+    NSParameterAssert(producer);
+    NSAssert(self.fragmentSize > 0, @"fragmentSize must be greater than 0");
+    PSWebSocketStreamedMessage *message = [[PSWebSocketStreamedMessage alloc] init];
+    message.producer = producer;
+    message.completion = completion;
+    message.binary = binary;
+    message.fragmentSize = self.fragmentSize;
+    [self executeWork:^{
+        [self sendMessage:message];
+    }];
+}
+- (void)enqueuePreparedMessage:(PSWebSocketPreparedMessage *)message {
+    // broadcasts arrive in bursts so collect them and hop onto the queue once per burst
+    BOOL schedule = NO;
+    @synchronized(_preparedMessageInbox) {
+        [_preparedMessageInbox addObject:message];
+        if(!_preparedMessageDrainScheduled) {
+            _preparedMessageDrainScheduled = YES;
+            schedule = YES;
         }
+    }
+    if(schedule) {
+        [self executeWork:^{
+            [self drainPreparedMessages];
+        }];
+    }
+}
+- (void)drainPreparedMessages {
+    NSArray *messages = nil;
+    @synchronized(_preparedMessageInbox) {
+        messages = [_preparedMessageInbox copy];
+        [_preparedMessageInbox removeAllObjects];
+        _preparedMessageDrainScheduled = NO;
+    }
+    // nothing may follow a close, so a broadcast caught mid close is dropped
+    if(_readyState >= PSWebSocketReadyStateClosing) {
+        return;
+    }
+    ++_batchDepth;
+    for(PSWebSocketPreparedMessage *message in messages) {
+        [self sendMessage:message];
+    }
+    --_batchDepth;
+    [self pumpOutput];
+}
+- (void)sendMessage:(id)message {
+    [self sendMessage:message compression:PSWebSocketDriverCompressionPolicy];
+}
+- (void)sendMessage:(id)message compression:(PSWebSocketDriverCompression)compression {
+    // data frames can't interleave with a fragmented message so hold them back
+    if(_streamedMessage) {
+        if(compression != PSWebSocketDriverCompressionPolicy) {
+            PSWebSocketOutgoingMessage *outgoing = [[PSWebSocketOutgoingMessage alloc] init];
+            outgoing.message = message;
+            outgoing.compression = compression;
+            message = outgoing;
+        }
+        [_pendingMessages addObject:message];
+        return;
+    }
+    
+    // a fragmented message is only left unfinished by aborting it, which closes the
+    // connection, and nothing but the close may follow it
+    if(_driver.sendingFragments && ![message isKindOfClass:[PSWebSocketStreamedMessage class]]) {
+        NSAssert(_readyState >= PSWebSocketReadyStateClosing, @"Cannot send a message while a fragmented message is unfinished");
+        return;
+    }
+    
+    if([message isKindOfClass:[PSWebSocketStreamedMessage class]]) {
+        _streamedMessage = message;
+        [self pumpStreamedMessage];
+    } else if([message isKindOfClass:[PSWebSocketOutgoingMessage class]]) {
+        [self sendMessage:[message message] compression:[message compression]];
+    } else if([message isKindOfClass:[NSString class]]) {
+        [_driver sendText:message compression:compression];
+    } else if([message isKindOfClass:[NSData class]]) {
+        [_driver sendBinary:message compression:compression];
+    } else if([message isKindOfClass:[PSWebSocketPreparedMessage class]]) {
+        [_driver sendPreparedMessage:message];
+    } else {
+        [NSException raise:@"Invalid Message" format:@"Messages must be instances of NSString or NSData"];
+    }
+}
+- (void)pauseReading {
+    [self executeWork:^{
+        _readingPaused = YES;
+    }];
+}
+- (void)resumeReading {
+    [self executeWork:^{
+        _readingPaused = NO;
+        [self pumpInput];
     }];
 }
 - (void)ping:(NSData *)pingData handler:(void (^)(NSData *pongData))handler {
@@ -260,44 +579,52 @@ void PSWebSocketAddBytesToByteCount(uint64_t bytes, PSWebSocketByteCount *byteCo
 }
 - (void)closeWithCode:(NSInteger)code reason:(NSString *)reason {
     [self executeWork:^{
-        // already closing so lets exit
-        if(_readyState >= PSWebSocketReadyStateClosing) {
-            return;
-        }
-        
-        BOOL connecting = (_readyState == PSWebSocketReadyStateConnecting);
-        _readyState = PSWebSocketReadyStateClosing;
-        
-        // send close code if we're not connecting
-        if(!connecting) {
-            [_driver sendCloseCode:code reason:reason];
-        }
-        
-        // disconnect gracefully
-        [self disconnectGracefully];
-        
-        // disconnect hard in 30 seconds
-        __weak typeof(self)weakSelf = self;
-        dispatch_after(dispatch_walltime(DISPATCH_TIME_NOW, 30.0 * NSEC_PER_SEC), dispatch_get_main_queue(), ^{
-            __strong typeof(weakSelf)strongSelf = weakSelf;
-            if(!strongSelf) return;
-            
-            [strongSelf executeWork:^{
-                if(strongSelf->_readyState >= PSWebSocketReadyStateClosed) {
-                    return;
-                }
-                [strongSelf disconnect];
-            }];
-        });
+        [self performCloseWithCode:code reason:reason];
     }];
 }
+- (void)performCloseWithCode:(NSInteger)code reason:(NSString *)reason {
+    // already closing so lets exit
+    if(_readyState >= PSWebSocketReadyStateClosing) {
+        return;
+    }
+    
+    BOOL connecting = (_readyState == PSWebSocketReadyStateConnecting);
+    _readyState = PSWebSocketReadyStateClosing;
+    
+    // send close code if we're not connecting
+    if(!connecting) {
+        [_driver sendCloseCode:code reason:reason];
+    }
+    
+    // abort any streamed message still in progress
+    [self pumpStreamedMessage];
+    
+    // disconnect gracefully
+    [self disconnectGracefully];
+    
+    // disconnect hard in 30 seconds
+    __weak typeof(self)weakSelf = self;
+    dispatch_after(dispatch_walltime(DISPATCH_TIME_NOW, 30.0 * NSEC_PER_SEC), dispatch_get_main_queue(), ^{
+        __strong typeof(weakSelf)strongSelf = weakSelf;
+        if(!strongSelf) return;
+        
+        [strongSelf executeWork:^{
+            if(strongSelf->_readyState >= PSWebSocketReadyStateClosed) {
+                return;
+            }
+            [strongSelf disconnect];
+        }];
+    });
+}
 
 #pragma mark - Stream Properties
 
 - (CFTypeRef)copyStreamPropertyForKey:(NSString *)key {
-    __block CFTypeRef result;
+    __block CFTypeRef result = NULL;
     [self executeWorkAndWait:^{
-        result = CFWriteStreamCopyProperty((__bridge CFWriteStreamRef)_outputStream, (__bridge CFStringRef)key);
+        if(_outputStream) {
+            result = CFWriteStreamCopyProperty((__bridge CFWriteStreamRef)_outputStream, (__bridge CFStringRef)key);
+        }
     }];
     return result;
 }
@@ -307,6 +634,10 @@ void PSWebSocketAddBytesToByteCount(uint64_t bytes, PSWebSocketByteCount *byteCo
             [NSException raise:@"Invalid State" format:@"You cannot set stream properties on a PSWebSocket once it is opened."];
             return;
         }
+        if(!_outputStream) {
+            [NSException raise:@"Invalid State" format:@"This PSWebSocket has no streams to set properties on."];
+            return;
+        }
         CFWriteStreamSetProperty((__bridge CFWriteStreamRef)_outputStream, (__bridge CFStringRef)key, (CFTypeRef)property);
     }];
 }
@@ -385,9 +716,17 @@ void PSWebSocketAddBytesToByteCount(uint64_t bytes, PSWebSocketByteCount *byteCo
     _inputStream.delegate = self;
     _outputStream.delegate = self;
     
-    // schedule streams
-    [_inputStream scheduleInRunLoop:[[self class] runLoop] forMode:NSDefaultRunLoopMode];
-    [_outputStream scheduleInRunLoop:[[self class] runLoop] forMode:NSDefaultRunLoopMode];
+    // schedule streams, staying on the same thread for the life of the connection
+    // or, for a plain socket handed over without streams, watch it from the work queue
+    if(_usesDispatchSources) {
+        [self resumeDispatchSources];
+    } else {
+        if(!_runLoop) {
+            _runLoop = [_eventLoopGroup acquireRunLoop];
+        }
+        [_inputStream scheduleInRunLoop:_runLoop forMode:NSDefaultRunLoopMode];
+        [_outputStream scheduleInRunLoop:_runLoop forMode:NSDefaultRunLoopMode];
+    }
     
     // open streams
     if(_inputStream.streamStatus == NSStreamStatusNotOpen) {
@@ -431,14 +770,125 @@ void PSWebSocketAddBytesToByteCount(uint64_t bytes, PSWebSocketByteCount *byteCo
     _inputStream.delegate = nil;
     _outputStream.delegate = nil;
     
-    [_inputStream close];
-    [_outputStream close];
+    // without streams the socket is ours to close
+    CFSocketNativeHandle ownedSocket = (_inputStream) ? -1 : _nativeSocket;
+    if(_sourceGroup) {
+        // the socket must outlive the sources watching it, close once both are cancelled
+        [self cancelDispatchSources];
+        NSInputStream *inputStream = _inputStream;
+        NSOutputStream *outputStream = _outputStream;
+        dispatch_group_notify(_sourceGroup, _workQueue, ^{
+            [inputStream close];
+            [outputStream close];
+            if(ownedSocket != -1) {
+                close(ownedSocket);
+            }
+        });
+        _sourceGroup = nil;
+    } else {
+        [_inputStream close];
+        [_outputStream close];
+        if(ownedSocket != -1) {
+            close(ownedSocket);
+        }
+    }
     
-    [_inputStream removeFromRunLoop:[[self class] runLoop] forMode:NSDefaultRunLoopMode];
-    [_outputStream removeFromRunLoop:[[self class] runLoop] forMode:NSDefaultRunLoopMode];
+    if(_runLoop) {
+        [_inputStream removeFromRunLoop:_runLoop forMode:NSDefaultRunLoopMode];
+        [_outputStream removeFromRunLoop:_runLoop forMode:NSDefaultRunLoopMode];
+        [_eventLoopGroup releaseRunLoop:_runLoop];
+        _runLoop = nil;
+    }
     
     _inputStream = nil;
     _outputStream = nil;
+    _nativeSocket = -1;
+}
+
+- (void)resumeDispatchSources {
+    __weak typeof(self)weakSelf = self;
+    if(!_sourceGroup) {
+        _sourceGroup = dispatch_group_create();
+    }
+    dispatch_group_t sourceGroup = _sourceGroup;
+    
+    // readable, level triggered so a short read simply waits for the next event
+    _readSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, _nativeSocket, 0, _workQueue);
+    dispatch_source_set_event_handler(_readSource, ^{
+        __strong typeof(weakSelf)strongSelf = weakSelf;
+        [strongSelf pumpInput];
+    });
+    dispatch_group_enter(sourceGroup);
+    dispatch_source_set_cancel_handler(_readSource, ^{
+        dispatch_group_leave(sourceGroup);
+    });
+    _readSourceSuspended = NO;
+    dispatch_resume(_readSource);
+    
+    [self createWriteSource];
+}
+- (void)createWriteSource {
+    __weak typeof(self)weakSelf = self;
+    if(!_sourceGroup) {
+        _sourceGroup = dispatch_group_create();
+    }
+    dispatch_group_t sourceGroup = _sourceGroup;
+    
+    // writable, created suspended and only watched while a write would block
+    _writeSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_WRITE, _nativeSocket, 0, _workQueue);
+    dispatch_source_set_event_handler(_writeSource, ^{
+        __strong typeof(weakSelf)strongSelf = weakSelf;
+        [strongSelf setWriteSourceSuspended:YES];
+        [strongSelf pumpOutput];
+    });
+    dispatch_group_enter(sourceGroup);
+    dispatch_source_set_cancel_handler(_writeSource, ^{
+        dispatch_group_leave(sourceGroup);
+    });
+    _writeSourceSuspended = YES;
+}
+- (void)cancelDispatchSources {
+    // suspended sources have to be resumed before they can be released
+    if(_readSource) {
+        dispatch_source_cancel(_readSource);
+        [self setReadSourceSuspended:NO];
+        _readSource = nil;
+    }
+    if(_writeSource) {
+        dispatch_source_cancel(_writeSource);
+        [self setWriteSourceSuspended:NO];
+        _writeSource = nil;
+    }
+}
+- (void)setReadSourceSuspended:(BOOL)suspended {
+    if(!_readSource || _readSourceSuspended == suspended) {
+        return;
+    }
+    _readSourceSuspended = suspended;
+    if(suspended) {
+        dispatch_suspend(_readSource);
+    } else {
+        dispatch_resume(_readSource);
+    }
+}
+- (void)setWriteSourceSuspended:(BOOL)suspended {
+    if(!_writeSource || _writeSourceSuspended == suspended) {
+        return;
+    }
+    _writeSourceSuspended = suspended;
+    if(suspended) {
+        dispatch_suspend(_writeSource);
+    } else {
+        dispatch_resume(_writeSource);
+    }
+}
+- (void)adoptRunLoop:(NSRunLoop *)runLoop fromEventLoopGroup:(PSWebSocketEventLoopGroup *)eventLoopGroup {
+    // a server hands over the thread a connection's handshake already ran on
+    [self executeWork:^{
+        NSAssert(!_opened && !_runLoop, @"Cannot adopt a run loop once opened");
+        _eventLoopGroup = eventLoopGroup;
+        _runLoop = runLoop;
+    }];
 }
 
 #pragma mark - Security
@@ -617,74 +1067,165 @@ void PSWebSocketAddBytesToByteCount(uint64_t bytes, PSWebSocketByteCount *byteCo
 #pragma mark - Pumping
 
 - (void)pumpInput {
-    if(_readyState >= PSWebSocketReadyStateClosing) {
+    if(_pumpingInput) {
         return;
     }
-    if(_pumpingInput) {
+    if(_readyState >= PSWebSocketReadyStateClosing || ![self shouldReadInput]) {
+        // stop the read source firing for input we won't take yet
+        [self setReadSourceSuspended:YES];
         return;
     }
+    [self setReadSourceSuspended:NO];
     _pumpingInput = YES;
     
+    BOOL inputEnded = NO;
     @autoreleasepool {
-        uint8_t chunkBuffer[4096];
-        while(_inputStream.hasBytesAvailable) {
-            NSInteger readLength = [_inputStream read:chunkBuffer maxLength:sizeof(chunkBuffer)];
+        // anything left over from before, e.g. bytes read while paused
+        [self executeInputBuffer];
+        
+        NSUInteger totalReadLength = 0;
+        while((_readSource || _inputStream.hasBytesAvailable) && [self shouldReadInput]) {
+            // read straight into the tail of the input buffer, the driver can hand out
+            // messages pointing into it without another copy
+            NSUInteger requestedLength = 0;
+            NSInteger readLength = 0;
+            if(_readSource) {
+                readLength = [_inputBuffer readFromSocket:_nativeSocket maxLength:_readLength requestedLength:&requestedLength];
+                if(readLength < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    break;
+                }
+                if(readLength < 0) {
+                    [self failWithError:[NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:nil]];
+                    break;
+                }
+                if(readLength == 0) {
+                    inputEnded = YES;
+                    break;
+                }
+            } else {
+                readLength = [_inputBuffer readFromStream:_inputStream maxLength:_readLength requestedLength:&requestedLength];
+                if(readLength < 0) {
+                    [self failWithError:_inputStream.streamError];
+                    break;
+                }
+            }
             if(readLength > 0) {
+                totalReadLength += readLength;
 				PSWebSocketAddBytesToByteCount(readLength, &_bytesReceived);
-                if(!_inputBuffer.hasBytesAvailable) {
-                    NSInteger consumedLength = -1;
-					if (_hasProxy && !_connectedToProxy) {
-						consumedLength = [self proxyCheckBytes:chunkBuffer maxLength:readLength];
-					} else {
-						consumedLength = [_driver execute:chunkBuffer maxLength:readLength];
-					}
-                    if(consumedLength < readLength) {
-                        NSInteger offset = MAX(0, consumedLength);
-                        NSInteger remaining = readLength - offset;
-                        [_inputBuffer appendBytes:chunkBuffer + offset length:remaining];
-                    }
-                } else {
-                    [_inputBuffer appendBytes:chunkBuffer length:readLength];
-                }
-            } else if(readLength < 0) {
-                [self failWithError:_inputStream.streamError];
-                break;
+                [self executeInputBuffer];
             }
-            if(readLength < sizeof(chunkBuffer)) {
+            if(readLength < requestedLength) {
                 break;
             }
         }
-        
-        while(_inputBuffer.hasBytesAvailable) {
-            NSInteger readLength = -1;
-			if (_hasProxy && !_connectedToProxy) {
-				readLength = [self proxyCheckBytes:_inputBuffer.mutableBytes maxLength:_inputBuffer.bytesAvailable];
-			} else {
-				readLength = [_driver execute:_inputBuffer.mutableBytes maxLength:_inputBuffer.bytesAvailable];
-			}
-            if(readLength <= 0) {
-                break;
-            }
-            _inputBuffer.offset += readLength;
+        if(totalReadLength > 0) {
+            [self adaptReadLength:totalReadLength];
+            [self noteCompressionActivity];
         }
-        
-        
-        [_inputBuffer compact];
     }
     
     _pumpingInput = NO;
-    if(_inputStream.hasBytesAvailable) {
+    if(inputEnded) {
+        [self didEndStream:_inputStream];
+    } else if(!_readSource && _inputStream.hasBytesAvailable) {
         [self pumpInput];
     }
 }
+- (void)executeInputBuffer {
+    while(_inputBuffer.hasBytesAvailable && [self shouldReadInput]) {
+        NSInteger readLength = -1;
+        if (_hasProxy && !_connectedToProxy) {
+            readLength = [self proxyCheckBytes:_inputBuffer.mutableBytes maxLength:_inputBuffer.contiguousBytesAvailable];
+        } else {
+            BOOL storageReferenced = NO;
+            readLength = [_driver execute:_inputBuffer.mutableBytes maxLength:_inputBuffer.contiguousBytesAvailable storage:_inputBuffer.contiguousStorage storageReferenced:&storageReferenced];
+            if(storageReferenced) {
+                [_inputBuffer markContiguousStorageShared];
+            }
+        }
+        if(readLength == 0 && [_inputBuffer expandContiguousBytes]) {
+            // what's needed straddles segments, retry with more bytes up front
+            continue;
+        }
+        if(readLength <= 0) {
+            break;
+        }
+        [_inputBuffer consume:readLength];
+    }
+}
+- (void)adaptReadLength:(NSUInteger)totalReadLength {
+    // grow while each readiness event fills the reads, shrink back once traffic is light
+    NSUInteger maxReadLength = MAX(_maxReadLength, PSWebSocketMinReadLength);
+    if(totalReadLength >= _readLength && _readLength < maxReadLength) {
+        _readLength = MIN(_readLength * 2, maxReadLength);
+    } else if(totalReadLength < _readLength / 4 && _readLength > PSWebSocketMinReadLength) {
+        _readLength = MAX(_readLength / 2, PSWebSocketMinReadLength);
+    } else if(_readLength > maxReadLength) {
+        _readLength = maxReadLength;
+    } else {
+        return;
+    }
+    _inputBuffer.segmentLength = _readLength;
+}
+- (void)noteCompressionActivity {
+    if(_compressionIdleInterval <= 0.0) {
+        return;
+    }
+    _compressionActivityTime = CFAbsoluteTimeGetCurrent();
+    if(!_compressionIdleCheckScheduled) {
+        _compressionIdleCheckScheduled = YES;
+        [self scheduleCompressionIdleCheckAfter:_compressionIdleInterval];
+    }
+}
+- (void)scheduleCompressionIdleCheckAfter:(NSTimeInterval)delay {
+    // a single check per websocket, pushed back while traffic keeps arriving
+    __weak typeof(self)weakSelf = self;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, delay * NSEC_PER_SEC), _workQueue, ^{
+        __strong typeof(weakSelf)strongSelf = weakSelf;
+        if(strongSelf) {
+            [strongSelf checkCompressionIdle];
+        }
+    });
+}
+- (void)checkCompressionIdle {
+    if(_readyState != PSWebSocketReadyStateOpen || _compressionIdleInterval <= 0.0) {
+        _compressionIdleCheckScheduled = NO;
+        return;
+    }
+    NSTimeInterval idle = CFAbsoluteTimeGetCurrent() - _compressionActivityTime;
+    if(idle >= _compressionIdleInterval) {
+        _compressionIdleCheckScheduled = NO;
+        [_driver purgeCompressionState];
+    } else {
+        [self scheduleCompressionIdleCheckAfter:_compressionIdleInterval - idle];
+    }
+}
+- (BOOL)shouldReadInput {
+    if(_readingPaused) {
+        return NO;
+    }
+    return (_maxUndeliveredMessages == 0 || _undeliveredMessages < _maxUndeliveredMessages);
+}
 - (void)pumpOutput {
+    [self updateBufferedAmount];
     if(_pumpingOutput) {
         return;
     }
+    // hold output while batching unless we're trying to close
+    if(_batchDepth > 0 && !_closeWhenFinishedOutput) {
+        return;
+    }
     _pumpingOutput = YES;
     
-    while(_outputStream.hasSpaceAvailable && _outputBuffer.hasBytesAvailable) {
-        NSInteger writeLength = [_outputStream write:_outputBuffer.bytes maxLength:_outputBuffer.bytesAvailable];
+    BOOL stalled = NO;
+    while((_writeSource || _outputStream.hasSpaceAvailable) && _outputBuffer.hasBytesAvailable) {
+        NSInteger writeLength = [self writeOutputBuffer];
+        if(writeLength == 0) {
+            // socket buffer is full, wait for the next space available event
+            stalled = YES;
+            [self watchForSpaceAvailable];
+            break;
+        }
         if(writeLength <= -1) {
             _failed = YES;
             [self disconnect];
@@ -693,14 +1234,15 @@ void PSWebSocketAddBytesToByteCount(uint64_t bytes, PSWebSocketByteCount *byteCo
             [self notifyDelegateDidFailWithError:error];
             return;
         }
-        _outputBuffer.offset += writeLength;
+        [_outputBuffer consume:writeLength];
 		
 		PSWebSocketAddBytesToByteCount(writeLength, &_bytesSent);
     }
+    BOOL inputOpen = (_inputStream) ? (_inputStream.streamStatus != NSStreamStatusNotOpen &&
+                                       _inputStream.streamStatus != NSStreamStatusClosed) : (_nativeSocket != -1);
     if(_closeWhenFinishedOutput &&
        !_outputBuffer.hasBytesAvailable &&
-       (_inputStream.streamStatus != NSStreamStatusNotOpen &&
-        _inputStream.streamStatus != NSStreamStatusClosed) &&
+       inputOpen &&
        !_sentClose) {
         _sentClose = YES;
         
@@ -711,22 +1253,166 @@ void PSWebSocketAddBytesToByteCount(uint64_t bytes, PSWebSocketByteCount *byteCo
         }
     }
     
-    [_outputBuffer compact];
-    
     _pumpingOutput = NO;
-    if(_outputStream.hasSpaceAvailable && _outputBuffer.hasBytesAvailable) {
+    [self updateBufferedAmount];
+    
+    // refill from a streamed message as the output drains
+    [self pumpStreamedMessage];
+    
+    if(!stalled && !_writeSource && _outputStream.hasSpaceAvailable && _outputBuffer.hasBytesAvailable) {
         [self pumpOutput];
     }
 }
+- (void)updateBufferedAmount {
+    NSUInteger bufferedAmount = _outputBuffer.bytesAvailable;
+    self.bufferedAmount = bufferedAmount;
+    
+    if(!_aboveHighWatermark && _highWatermark > 0 && bufferedAmount >= _highWatermark) {
+        _aboveHighWatermark = YES;
+        [self notifyDelegateDidReachHighWatermark];
+    } else if(_aboveHighWatermark && bufferedAmount <= _lowWatermark) {
+        _aboveHighWatermark = NO;
+        [self notifyDelegateDidDrainToLowWatermark];
+    }
+}
+- (void)pumpStreamedMessage {
+    if(_pumpingStreamedMessage || !_streamedMessage || _readyState == PSWebSocketReadyStateConnecting) {
+        return;
+    }
+    if(_readyState != PSWebSocketReadyStateOpen) {
+        NSString *reason = @"Connection closed before the message was sent";
+        NSError *error = [NSError errorWithDomain:PSWebSocketErrorDomain code:PSWebSocketErrorCodeConnectionFailed userInfo:@{NSLocalizedDescriptionKey: reason}];
+        [self finishStreamedMessageWithError:error];
+        return;
+    }
+    _pumpingStreamedMessage = YES;
+    
+    // keep about one fragment queued ahead of the socket
+    PSWebSocketStreamedMessage *message = _streamedMessage;
+    while(_streamedMessage == message &&
+          _readyState == PSWebSocketReadyStateOpen &&
+          _outputBuffer.bytesAvailable < message.fragmentSize) {
+        if(!_driver.sendingFragments) {
+            if(message.binary) {
+                [_driver beginFragmentedBinary];
+            } else {
+                [_driver beginFragmentedText];
+            }
+        }
+        
+        NSError *error = nil;
+        NSData *data = message.producer(message.fragmentSize, &error);
+        if(error) {
+            // a fragmented message can't be abandoned part way so the connection has to go
+            _pumpingStreamedMessage = NO;
+            [self finishStreamedMessageWithError:error];
+            [self performCloseWithCode:PSWebSocketStatusCodeInternalError reason:@"Failed to produce message"];
+            return;
+        }
+        if(data.length > 0) {
+            [_driver sendFragment:[data copy] final:NO];
+        } else {
+            [_driver sendFragment:[NSData data] final:YES];
+            _pumpingStreamedMessage = NO;
+            [self finishStreamedMessageWithError:nil];
+            return;
+        }
+    }
+    
+    _pumpingStreamedMessage = NO;
+}
+- (void)finishStreamedMessageWithError:(NSError *)error {
+    PSWebSocketStreamedMessage *message = _streamedMessage;
+    _streamedMessage = nil;
+    if(message.completion) {
+        [self executeDelegate:^{
+            message.completion(error);
+        }];
+    }
+    
+    NSArray *pending = [_pendingMessages copy];
+    [_pendingMessages removeAllObjects];
+    if(error) {
+        // nothing queued behind an aborted message can be sent
+        for(id pendingMessage in pending) {
+            if([pendingMessage isKindOfClass:[PSWebSocketStreamedMessage class]] && [pendingMessage completion]) {
+                void (^completion)(NSError *) = [pendingMessage completion];
+                [self executeDelegate:^{
+                    completion(error);
+                }];
+            }
+        }
+        return;
+    }
+    for(id pendingMessage in pending) {
+        [self sendMessage:pendingMessage];
+    }
+}
+
+- (NSInteger)writeOutputBuffer {
+    // plain sockets gather every queued header & payload into a single writev
+    if(!_secure && [self nativeSocket] != -1) {
+        struct iovec iovecs[PSWebSocketMaxWriteIOVecs];
+        NSUInteger count = [_outputBuffer getReadableIOVecs:iovecs maxCount:PSWebSocketMaxWriteIOVecs];
+        ssize_t writeLength;
+        do {
+            writeLength = writev(_nativeSocket, iovecs, (int)count);
+        } while(writeLength < 0 && errno == EINTR);
+        if(writeLength < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        return writeLength;
+    }
+    
+    // otherwise the stream has to see every byte (TLS), one segment at a time
+    return [_outputStream write:_outputBuffer.bytes maxLength:_outputBuffer.contiguousBytesAvailable];
+}
+- (void)watchForSpaceAvailable {
+    // writev went behind the stream's back so it won't report space again, watch the
+    // socket for it instead. Writes through the stream (TLS) re-arm it themselves.
+    if(_secure || _nativeSocket == -1) {
+        return;
+    }
+    if(!_writeSource) {
+        [self createWriteSource];
+    }
+    [self setWriteSourceSuspended:NO];
+}
+- (CFSocketNativeHandle)nativeSocket {
+    if(_nativeSocket == -1 && _outputStream.streamStatus == NSStreamStatusOpen) {
+        CFDataRef handleData = CFWriteStreamCopyProperty((__bridge CFWriteStreamRef)_outputStream, kCFStreamPropertySocketNativeHandle);
+        if(handleData) {
+            if(CFDataGetLength(handleData) == sizeof(CFSocketNativeHandle)) {
+                CFSocketNativeHandle handle = -1;
+                CFDataGetBytes(handleData, CFRangeMake(0, sizeof(handle)), (UInt8 *)&handle);
+                PSWebSocketConfigureNativeSocket(handle);
+                _nativeSocket = handle;
+            }
+            CFRelease(handleData);
+        }
+    }
+    return _nativeSocket;
+}
 
 #pragma mark - Failing
 
+- (void)didEndStream:(NSStream *)stream {
+    _readyState = PSWebSocketReadyStateClosed;
+    if(!_sentClose && !_failed) {
+        _failed = YES;
+        NSString *reason = [NSString stringWithFormat:@"%@ stream end encountered", (stream == _inputStream) ? @"Input" : @"Output"];
+        [self disconnect];
+        NSError *error = [NSError errorWithDomain:PSWebSocketErrorDomain code:PSWebSocketErrorCodeConnectionFailed userInfo:@{NSLocalizedDescriptionKey: reason}];
+        [self notifyDelegateDidFailWithError:error];
+    }
+}
+
 - (void)failWithCode:(NSInteger)code reason:(NSString *)reason {
     NSDictionary *userInfo = @{NSLocalizedDescriptionKey: reason};
     [self failWithError:[NSError errorWithDomain:PSWebSocketErrorDomain code:code userInfo:userInfo]];
 }
 - (void)failWithError:(NSError *)error {
-    if(error.code == PSWebSocketStatusCodeProtocolError) {
+    if(error.code == PSWebSocketStatusCodeProtocolError || error.code == PSWebSocketStatusCodeMessageTooBig) {
         [self executeDelegate:^{
             _closeCode = error.code;
             _closeReason = error.localizedDescription;
@@ -775,6 +1461,18 @@ void PSWebSocketAddBytesToByteCount(uint64_t bytes, PSWebSocketByteCount *byteCo
 - (void)driver:(PSWebSocketDriver *)driver didReceiveMessage:(id)message {
     [self notifyDelegateDidReceiveMessage:message];
 }
+- (void)driver:(PSWebSocketDriver *)driver didReceiveTextMessage:(NSData *)utf8Data {
+    [self notifyDelegateDidReceiveUTF8Message:utf8Data];
+}
+- (void)driver:(PSWebSocketDriver *)driver didBeginMessage:(BOOL)binary {
+    [self notifyDelegateDidBeginMessage:binary];
+}
+- (void)driver:(PSWebSocketDriver *)driver didReceiveMessageChunk:(NSData *)chunk {
+    [self notifyDelegateDidReceiveMessageChunk:chunk];
+}
+- (void)driverDidEndMessage:(PSWebSocketDriver *)driver {
+    [self notifyDelegateDidEndMessage];
+}
 - (void)driver:(PSWebSocketDriver *)driver didReceivePing:(NSData *)ping {
     [self executeDelegate:^{
         [self executeWork:^{
@@ -796,6 +1494,16 @@ void PSWebSocketAddBytesToByteCount(uint64_t bytes, PSWebSocketByteCount *byteCo
         return;
     }
     [_outputBuffer appendData:data];
+    [self noteCompressionActivity];
+    [self pumpOutput];
+}
+- (void)driver:(PSWebSocketDriver *)driver writeHeader:(const void *)header length:(NSUInteger)headerLength payload:(NSData *)payload {
+    if(_closeWhenFinishedOutput) {
+        return;
+    }
+    [_outputBuffer appendBytes:header length:headerLength];
+    [_outputBuffer appendDataNoCopy:payload];
+    [self noteCompressionActivity];
     [self pumpOutput];
 }
 
@@ -882,14 +1590,7 @@ void PSWebSocketAddBytesToByteCount(uint64_t bytes, PSWebSocketByteCount *byteCo
                 if(stream.streamError) {
                     [self failWithError:stream.streamError];
                 } else {
-                    _readyState = PSWebSocketReadyStateClosed;
-                    if(!_sentClose && !_failed) {
-                        _failed = YES;
-                        [self disconnect];
-                        NSString *reason = [NSString stringWithFormat:@"%@ stream end encountered", (stream == _inputStream) ? @"Input" : @"Output"];
-                        NSError *error = [NSError errorWithDomain:PSWebSocketErrorDomain code:PSWebSocketErrorCodeConnectionFailed userInfo:@{NSLocalizedDescriptionKey: reason}];
-                        [self notifyDelegateDidFailWithError:error];
-                    }
+                    [self didEndStream:stream];
                 }
                 break;
             }
@@ -915,10 +1616,55 @@ void PSWebSocketAddBytesToByteCount(uint64_t bytes, PSWebSocketByteCount *byteCo
     }];
 }
 - (void)notifyDelegateDidReceiveMessage:(id)message {
-    [self executeDelegate:^{
+    [self executeDelegateMessage:^{
         [_delegate webSocket:self didReceiveMessage:message];
     }];
 }
+- (void)notifyDelegateDidReceiveUTF8Message:(NSData *)message {
+    [self executeDelegateMessage:^{
+        if([_delegate respondsToSelector:@selector(webSocket:didReceiveUTF8Message:)]) {
+            [_delegate webSocket:self didReceiveUTF8Message:message];
+        } else {
+            NSString *text = [[NSString alloc] initWithData:message encoding:NSUTF8StringEncoding];
+            [_delegate webSocket:self didReceiveMessage:text];
+        }
+    }];
+}
+- (void)notifyDelegateDidBeginMessage:(BOOL)binary {
+    [self executeDelegate:^{
+        if([_delegate respondsToSelector:@selector(webSocket:didBeginMessage:)]) {
+            [_delegate webSocket:self didBeginMessage:binary];
+        }
+    }];
+}
+- (void)notifyDelegateDidReceiveMessageChunk:(NSData *)chunk {
+    [self executeDelegateMessage:^{
+        if([_delegate respondsToSelector:@selector(webSocket:didReceiveMessageChunk:)]) {
+            [_delegate webSocket:self didReceiveMessageChunk:chunk];
+        }
+    }];
+}
+- (void)notifyDelegateDidEndMessage {
+    [self executeDelegate:^{
+        if([_delegate respondsToSelector:@selector(webSocketDidEndMessage:)]) {
+            [_delegate webSocketDidEndMessage:self];
+        }
+    }];
+}
+- (void)notifyDelegateDidReachHighWatermark {
+    [self executeDelegate:^{
+        if([_delegate respondsToSelector:@selector(webSocketDidReachHighWatermark:)]) {
+            [_delegate webSocketDidReachHighWatermark:self];
+        }
+    }];
+}
+- (void)notifyDelegateDidDrainToLowWatermark {
+    [self executeDelegate:^{
+        if([_delegate respondsToSelector:@selector(webSocketDidDrainToLowWatermark:)]) {
+            [_delegate webSocketDidDrainToLowWatermark:self];
+        }
+    }];
+}
 - (void)notifyDelegateDidFailWithError:(NSError *)error {
     [self executeDelegate:^{
         [_delegate webSocket:self didFailWithError:error];
@@ -944,6 +1690,23 @@ void PSWebSocketAddBytesToByteCount(uint64_t bytes, PSWebSocketByteCount *byteCo
     NSParameterAssert(work);
     dispatch_async((_delegateQueue) ? _delegateQueue : dispatch_get_main_queue(), work);
 }
+- (void)executeDelegateMessage:(void (^)(void))work {
+    NSParameterAssert(work);
+    if(_maxUndeliveredMessages == 0) {
+        [self executeDelegate:work];
+        return;
+    }
+    
+    // count the message until the delegate has seen it so input can stop while it catches up
+    ++_undeliveredMessages;
+    [self executeDelegate:^{
+        work();
+        [self executeWork:^{
+            --_undeliveredMessages;
+            [self pumpInput];
+        }];
+    }];
+}
 - (void)executeDelegateAndWait:(void (^)(void))work {
     NSParameterAssert(work);
     dispatch_sync((_delegateQueue) ? _delegateQueue : dispatch_get_main_queue(), work);
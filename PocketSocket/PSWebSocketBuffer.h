@@ -13,14 +13,22 @@
 //  limitations under the License.
 
 #import <Foundation/Foundation.h>
+#import <sys/uio.h>
 
 
+/**
+ *  A byte queue stored as a chain of fixed size segments. Appending never
+ *  moves bytes already stored and consuming releases whole segments, so
+ *  there is no compaction or reallocation as data flows through.
+ */
 @interface PSWebSocketBuffer : NSObject
 
 #pragma mark - Properties
 
-@property (nonatomic, assign) NSInteger offset;
-@property (nonatomic, assign) NSUInteger compactionLength;
+/**
+ *  Capacity of newly allocated segments, defaults to 16384
+ */
+@property (nonatomic, assign) NSUInteger segmentLength;
 
 #pragma mark - Actions
 
@@ -28,10 +36,89 @@
 - (NSUInteger)bytesAvailable;
 - (void)appendData:(NSData *)data;
 - (void)appendBytes:(const void *)bytes length:(NSUInteger)length;
-- (void)compact;
+
+/**
+ *  Append data by reference rather than copying it. The data is kept as its own
+ *  segment so it must not be mutated afterwards. Small data is still copied.
+ */
+- (void)appendDataNoCopy:(NSData *)data;
+- (void)consume:(NSUInteger)length;
 - (void)reset;
+
+#pragma mark - Contiguous Access
+
+/**
+ *  Number of bytes readable from bytes / mutableBytes, the unconsumed part
+ *  of the first segment
+ */
+- (NSUInteger)contiguousBytesAvailable;
 - (const void *)bytes;
 - (void *)mutableBytes;
-- (NSData *)data;
+
+/**
+ *  The object backing bytes / mutableBytes. Once marked shared its bytes are
+ *  never rewritten, so references into it stay valid after they are consumed.
+ */
+- (NSData *)contiguousStorage;
+- (void)markContiguousStorageShared;
+
+/**
+ *  Copy bytes from following segments into the first so a header that straddles
+ *  segments can be parsed in one piece. Only the first few bytes are moved.
+ *
+ *  @return NO if all available bytes were already contiguous
+ */
+- (BOOL)expandContiguousBytes;
+
+#pragma mark - Scatter / Gather
+
+/**
+ *  Fill iovecs with the readable regions of the buffer in order
+ *
+ *  @return number of iovecs filled
+ */
+- (NSUInteger)getReadableIOVecs:(struct iovec *)iovecs maxCount:(NSUInteger)maxCount;
+
+/**
+ *  Ensure at least length bytes of free space at the tail of the buffer and fill
+ *  iovecs with it. Follow with commit: before mutating the buffer in any other way.
+ *
+ *  @return number of iovecs filled
+ */
+- (NSUInteger)reserve:(NSUInteger)length iovecs:(struct iovec *)iovecs maxCount:(NSUInteger)maxCount;
+
+/**
+ *  Mark length bytes written into the space handed out by reserve:iovecs:maxCount:
+ *  as readable
+ */
+- (void)commit:(NSUInteger)length;
+
+#pragma mark - Streams
+
+/**
+ *  Read from a stream straight into the free space at the tail of the buffer. At most
+ *  maxLength bytes are read and never more than the tail segment has room for.
+ *
+ *  @param stream             stream to read from
+ *  @param maxLength          maximum number of bytes to read
+ *  @param outRequestedLength set to the number of bytes asked for, a shorter read
+ *                            means the stream has nothing more to give right now
+ *
+ *  @return the result of reading from the stream
+ */
+- (NSInteger)readFromStream:(NSInputStream *)stream maxLength:(NSUInteger)maxLength requestedLength:(NSUInteger *)outRequestedLength;
+
+/**
+ *  Read from a non-blocking socket straight into the free space at the tail of the
+ *  buffer, as readFromStream:maxLength:requestedLength: does.
+ *
+ *  @param socket             socket to read from
+ *  @param maxLength          maximum number of bytes to read
+ *  @param outRequestedLength set to the number of bytes asked for
+ *
+ *  @return the result of read(2), 0 at end of stream and -1 with errno set on error
+ *          including EAGAIN when nothing more is available
+ */
+- (NSInteger)readFromSocket:(int)socket maxLength:(NSUInteger)maxLength requestedLength:(NSUInteger *)outRequestedLength;
 
 @end
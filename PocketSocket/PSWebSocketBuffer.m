@@ -13,9 +13,52 @@
 //  limitations under the License.
 
 #import "PSWebSocketBuffer.h"
+#import <unistd.h>
+#import <errno.h>
+
+// below this referencing data costs more than copying it into the tail segment
+static const NSUInteger PSWebSocketBufferMinNoCopyLength = 1024;
+
+@interface PSWebSocketBufferSegment : NSObject {
+@public
+    NSData *data;
+    uint8_t *bytes;
+    NSUInteger capacity;
+    NSUInteger readOffset;
+    NSUInteger writeOffset;
+    BOOL shared;
+}
+@end
+@implementation PSWebSocketBufferSegment
+
+- (instancetype)initWithCapacity:(NSUInteger)segmentCapacity {
+    if((self = [super init])) {
+        NSMutableData *storage = [NSMutableData dataWithLength:segmentCapacity];
+        data = storage;
+        bytes = storage.mutableBytes;
+        capacity = segmentCapacity;
+    }
+    return self;
+}
+- (instancetype)initWithData:(NSData *)referencedData {
+    if((self = [super init])) {
+        // full & shared so it is never written into or recycled
+        data = referencedData;
+        bytes = (uint8_t *)referencedData.bytes;
+        capacity = referencedData.length;
+        writeOffset = capacity;
+        shared = YES;
+    }
+    return self;
+}
+
+@end
 
 @interface PSWebSocketBuffer() {
-    NSMutableData *_data;
+    NSMutableArray *_segments;
+    NSUInteger _bytesAvailable;
+    NSUInteger _reserveIndex;
+    PSWebSocketBufferSegment *_spareSegment;
 }
 
 @end
@@ -25,9 +68,9 @@
 
 - (instancetype)init {
     if((self = [super init])) {
-        _data = [NSMutableData data];
-        _offset = 0;
-        _compactionLength = 4096;
+        _segments = [NSMutableArray array];
+        _bytesAvailable = 0;
+        _segmentLength = 16384;
     }
     return self;
 }
@@ -35,40 +78,237 @@
 #pragma mark - Actions
 
 - (BOOL)hasBytesAvailable {
-    return _data.length > _offset;
+    return _bytesAvailable > 0;
 }
 - (NSUInteger)bytesAvailable {
-    if(_data.length > _offset) {
-        return _data.length - _offset;
-    }
-    return 0;
+    return _bytesAvailable;
 }
 - (void)appendData:(NSData *)data {
-    [_data appendData:data];
+    [self appendBytes:data.bytes length:data.length];
 }
 - (void)appendBytes:(const void *)bytes length:(NSUInteger)length {
-    [_data appendBytes:bytes length:length];
+    while(length > 0) {
+        PSWebSocketBufferSegment *tail = _segments.lastObject;
+        if(!tail || tail->writeOffset == tail->capacity) {
+            tail = [self addSegmentWithCapacity:_segmentLength];
+        }
+        NSUInteger copyLength = MIN(length, tail->capacity - tail->writeOffset);
+        memcpy(tail->bytes + tail->writeOffset, bytes, copyLength);
+        tail->writeOffset += copyLength;
+        _bytesAvailable += copyLength;
+        bytes = (const uint8_t *)bytes + copyLength;
+        length -= copyLength;
+    }
+}
+- (void)appendDataNoCopy:(NSData *)data {
+    if(data.length < PSWebSocketBufferMinNoCopyLength) {
+        [self appendBytes:data.bytes length:data.length];
+        return;
+    }
+    [_segments addObject:[[PSWebSocketBufferSegment alloc] initWithData:data]];
+    _bytesAvailable += data.length;
 }
-- (void)compact {
-    if(_offset > _compactionLength && _offset > (_data.length >> 1)) {
-        _data = [NSMutableData dataWithBytes:(char *)_data.bytes + _offset
-                                      length:_data.length - _offset];
-        _offset = 0;
+- (void)consume:(NSUInteger)length {
+    NSAssert(length <= _bytesAvailable, @"Cannot consume more bytes than are available");
+    length = MIN(length, _bytesAvailable);
+    _bytesAvailable -= length;
+    while(_segments.count > 0) {
+        PSWebSocketBufferSegment *head = _segments[0];
+        NSUInteger consumeLength = MIN(length, head->writeOffset - head->readOffset);
+        head->readOffset += consumeLength;
+        length -= consumeLength;
+        if(head->readOffset < head->writeOffset) {
+            break;
+        }
+        
+        // the tail segment can keep taking appends in place
+        if(_segments.count == 1 && head->writeOffset < head->capacity) {
+            if(!head->shared) {
+                head->readOffset = 0;
+                head->writeOffset = 0;
+            }
+            break;
+        }
+        
+        [_segments removeObjectAtIndex:0];
+        [self recycleSegment:head];
     }
 }
 - (void)reset {
-    _offset = 0;
-    _data.length = 0;
+    [_segments removeAllObjects];
+    _spareSegment = nil;
+    _bytesAvailable = 0;
+}
+
+#pragma mark - Contiguous Access
+
+- (NSUInteger)contiguousBytesAvailable {
+    PSWebSocketBufferSegment *head = _segments.firstObject;
+    return (head) ? head->writeOffset - head->readOffset : 0;
 }
 - (const void *)bytes {
-    return _data.bytes + _offset;
+    PSWebSocketBufferSegment *head = _segments.firstObject;
+    return (head) ? head->bytes + head->readOffset : NULL;
 }
 - (void *)mutableBytes {
-    return _data.mutableBytes + _offset;
+    PSWebSocketBufferSegment *head = _segments.firstObject;
+    return (head) ? head->bytes + head->readOffset : NULL;
+}
+- (NSData *)contiguousStorage {
+    PSWebSocketBufferSegment *head = _segments.firstObject;
+    return head->data;
+}
+- (void)markContiguousStorageShared {
+    PSWebSocketBufferSegment *head = _segments.firstObject;
+    if(head) {
+        head->shared = YES;
+    }
 }
-- (NSData *)data {
-    return [_data copy];
+- (BOOL)expandContiguousBytes {
+    NSUInteger contiguous = [self contiguousBytesAvailable];
+    if(contiguous >= _bytesAvailable) {
+        return NO;
+    }
+    
+    // grow geometrically so repeated expansion of a long header stays linear
+    NSUInteger length = MIN(_bytesAvailable, contiguous * 2 + 16);
+    
+    // usually a header of a few bytes, so take the spare or size a scratch segment to fit
+    PSWebSocketBufferSegment *segment = nil;
+    if(_spareSegment && _spareSegment->capacity >= length) {
+        segment = _spareSegment;
+        _spareSegment = nil;
+    } else {
+        segment = [[PSWebSocketBufferSegment alloc] initWithCapacity:length];
+    }
+    NSUInteger copied = 0;
+    for(PSWebSocketBufferSegment *source in _segments) {
+        NSUInteger copyLength = MIN(length - copied, source->writeOffset - source->readOffset);
+        memcpy(segment->bytes + copied, source->bytes + source->readOffset, copyLength);
+        copied += copyLength;
+        if(copied == length) {
+            break;
+        }
+    }
+    segment->writeOffset = length;
+    
+    [self consume:length];
+    [_segments insertObject:segment atIndex:0];
+    _bytesAvailable += length;
+    return YES;
 }
 
+#pragma mark - Scatter / Gather
+
+- (NSUInteger)getReadableIOVecs:(struct iovec *)iovecs maxCount:(NSUInteger)maxCount {
+    NSUInteger count = 0;
+    for(PSWebSocketBufferSegment *segment in _segments) {
+        if(count == maxCount) {
+            break;
+        }
+        if(segment->writeOffset > segment->readOffset) {
+            iovecs[count].iov_base = segment->bytes + segment->readOffset;
+            iovecs[count].iov_len = segment->writeOffset - segment->readOffset;
+            ++count;
+        }
+    }
+    return count;
+}
+- (NSUInteger)reserve:(NSUInteger)length iovecs:(struct iovec *)iovecs maxCount:(NSUInteger)maxCount {
+    // start at the tail if it still has room
+    PSWebSocketBufferSegment *tail = _segments.lastObject;
+    NSUInteger available = 0;
+    if(tail && tail->writeOffset < tail->capacity) {
+        _reserveIndex = _segments.count - 1;
+        available = tail->capacity - tail->writeOffset;
+    } else {
+        _reserveIndex = _segments.count;
+    }
+    while(available < length) {
+        available += [self addSegmentWithCapacity:_segmentLength]->capacity;
+    }
+    
+    NSUInteger count = 0;
+    for(NSUInteger i = _reserveIndex; i < _segments.count && count < maxCount; ++i) {
+        PSWebSocketBufferSegment *segment = _segments[i];
+        iovecs[count].iov_base = segment->bytes + segment->writeOffset;
+        iovecs[count].iov_len = segment->capacity - segment->writeOffset;
+        ++count;
+    }
+    return count;
+}
+- (void)commit:(NSUInteger)length {
+    _bytesAvailable += length;
+    for(NSUInteger i = _reserveIndex; i < _segments.count && length > 0; ++i) {
+        PSWebSocketBufferSegment *segment = _segments[i];
+        NSUInteger commitLength = MIN(length, segment->capacity - segment->writeOffset);
+        segment->writeOffset += commitLength;
+        length -= commitLength;
+    }
+    NSAssert(length == 0, @"Cannot commit more bytes than were reserved");
+    
+    // drop reserved segments that received nothing
+    while(_segments.count > _reserveIndex + 1) {
+        PSWebSocketBufferSegment *tail = _segments.lastObject;
+        if(tail->writeOffset > 0) {
+            break;
+        }
+        [_segments removeLastObject];
+        [self recycleSegment:tail];
+    }
+}
+
+#pragma mark - Streams
+
+- (NSInteger)readFromStream:(NSInputStream *)stream maxLength:(NSUInteger)maxLength requestedLength:(NSUInteger *)outRequestedLength {
+    NSParameterAssert(maxLength > 0);
+    struct iovec iovec;
+    [self reserve:1 iovecs:&iovec maxCount:1];
+    NSUInteger requestedLength = MIN(iovec.iov_len, maxLength);
+    NSInteger readLength = [stream read:iovec.iov_base maxLength:requestedLength];
+    [self commit:(readLength > 0) ? readLength : 0];
+    if(outRequestedLength) {
+        *outRequestedLength = requestedLength;
+    }
+    return readLength;
+}
+- (NSInteger)readFromSocket:(int)socket maxLength:(NSUInteger)maxLength requestedLength:(NSUInteger *)outRequestedLength {
+    NSParameterAssert(maxLength > 0);
+    struct iovec iovec;
+    [self reserve:1 iovecs:&iovec maxCount:1];
+    NSUInteger requestedLength = MIN(iovec.iov_len, maxLength);
+    ssize_t readLength;
+    do {
+        readLength = read(socket, iovec.iov_base, requestedLength);
+    } while(readLength < 0 && errno == EINTR);
+    [self commit:(readLength > 0) ? readLength : 0];
+    if(outRequestedLength) {
+        *outRequestedLength = requestedLength;
+    }
+    return readLength;
+}
+
+#pragma mark - Segments
+
+- (PSWebSocketBufferSegment *)addSegmentWithCapacity:(NSUInteger)capacity {
+    PSWebSocketBufferSegment *segment = nil;
+    if(_spareSegment && _spareSegment->capacity >= capacity) {
+        segment = _spareSegment;
+        _spareSegment = nil;
+    } else {
+        segment = [[PSWebSocketBufferSegment alloc] initWithCapacity:capacity];
+    }
+    [_segments addObject:segment];
+    return segment;
+}
+- (void)recycleSegment:(PSWebSocketBufferSegment *)segment {
+    // keep one unshared segment around so steady traffic doesn't allocate
+    if(segment->shared || segment->capacity != _segmentLength || _spareSegment) {
+        return;
+    }
+    segment->readOffset = 0;
+    segment->writeOffset = 0;
+    _spareSegment = segment;
+}
 
 @end
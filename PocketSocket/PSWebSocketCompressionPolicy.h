@@ -0,0 +1,91 @@
+//  Copyright 2014 Zwopple Limited
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+/**
+ *  Decides per message whether permessage-deflate is worth using. Payloads that are too
+ *  small or that look incompressible are sent as they are, and the running results
+ *  of compressing everything else are used to tune the size threshold. A policy is used
+ *  on its websocket's queue and should not be shared between websockets.
+ */
+@interface PSWebSocketCompressionPolicy : NSObject
+
+#pragma mark - Properties
+
+/**
+ *  Payloads shorter than this are never compressed. Adjusted over time when adaptive
+ *  is set. Defaults to 128.
+ */
+@property (nonatomic, assign) NSUInteger minimumLength;
+
+/**
+ *  Number of bytes sampled, spread across the payload, to estimate whether it will
+ *  compress. 0 disables sampling. Defaults to 512.
+ */
+@property (nonatomic, assign) NSUInteger sampleLength;
+
+/**
+ *  Samples with more bits of entropy per byte than this are treated as already
+ *  compressed or encrypted. Defaults to 7.2, text is usually well under 6.
+ */
+@property (nonatomic, assign) double maximumSampleEntropy;
+
+/**
+ *  Whether minimumLength rises when payloads close to it compress poorly and falls
+ *  when they compress well. Defaults to YES.
+ */
+@property (nonatomic, assign, getter=isAdaptive) BOOL adaptive;
+
+#pragma mark - Statistics
+
+@property (nonatomic, assign, readonly) NSUInteger compressedMessageCount;
+@property (nonatomic, assign, readonly) NSUInteger skippedMessageCount;
+@property (nonatomic, assign, readonly) uint64_t uncompressedByteCount;
+@property (nonatomic, assign, readonly) uint64_t compressedByteCount;
+@property (nonatomic, assign, readonly) NSTimeInterval compressionTime;
+
+/**
+ *  Moving average of compressed length over uncompressed length, 1.0 until something
+ *  has been compressed
+ */
+@property (nonatomic, assign, readonly) double averageRatio;
+
+#pragma mark - Actions
+
+/**
+ *  Decide whether a payload should be compressed, counting it as skipped if not
+ *
+ *  @param bytes  payload bytes
+ *  @param length payload length
+ *
+ *  @return whether to compress the payload
+ */
+- (BOOL)shouldCompressBytes:(const void *)bytes length:(NSUInteger)length;
+
+/**
+ *  Record the outcome of compressing a payload
+ *
+ *  @param length           uncompressed length
+ *  @param compressedLength length after deflate
+ *  @param duration         time spent deflating
+ */
+- (void)recordCompressionOfLength:(NSUInteger)length compressedLength:(NSUInteger)compressedLength duration:(NSTimeInterval)duration;
+
+/**
+ *  Reset the statistics, leaving the thresholds as they are
+ */
+- (void)resetStatistics;
+
+@end
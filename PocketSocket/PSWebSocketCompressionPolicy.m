@@ -0,0 +1,110 @@
+//  Copyright 2014 Zwopple Limited
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#import "PSWebSocketCompressionPolicy.h"
+#import <math.h>
+
+// bounds minimumLength is tuned within
+static const NSUInteger PSWebSocketCompressionPolicyMinMinimumLength = 32;
+static const NSUInteger PSWebSocketCompressionPolicyMaxMinimumLength = 16384;
+
+// ratios that count as compressing poorly or well when tuning
+static const double PSWebSocketCompressionPolicyPoorRatio = 0.9;
+static const double PSWebSocketCompressionPolicyGoodRatio = 0.5;
+
+// weight of each new ratio in the moving average
+static const double PSWebSocketCompressionPolicyRatioWeight = 0.125;
+
+@implementation PSWebSocketCompressionPolicy
+
+#pragma mark - Initialization
+
+- (instancetype)init {
+    if((self = [super init])) {
+        _minimumLength = 128;
+        _sampleLength = 512;
+        _maximumSampleEntropy = 7.2;
+        _adaptive = YES;
+        [self resetStatistics];
+    }
+    return self;
+}
+
+#pragma mark - Actions
+
+- (BOOL)shouldCompressBytes:(const void *)bytes length:(NSUInteger)length {
+    if(length < _minimumLength ||
+       (_sampleLength > 0 && [self sampleEntropyOfBytes:bytes length:length] > _maximumSampleEntropy)) {
+        ++_skippedMessageCount;
+        return NO;
+    }
+    return YES;
+}
+- (void)recordCompressionOfLength:(NSUInteger)length compressedLength:(NSUInteger)compressedLength duration:(NSTimeInterval)duration {
+    if(length == 0) {
+        return;
+    }
+    ++_compressedMessageCount;
+    _uncompressedByteCount += length;
+    _compressedByteCount += compressedLength;
+    _compressionTime += duration;
+    
+    double ratio = (double)compressedLength / length;
+    if(_compressedMessageCount == 1) {
+        _averageRatio = ratio;
+    } else {
+        _averageRatio += (ratio - _averageRatio) * PSWebSocketCompressionPolicyRatioWeight;
+    }
+    
+    // only payloads near the threshold say anything about where it should be
+    if(_adaptive && length < _minimumLength * 4) {
+        if(ratio >= PSWebSocketCompressionPolicyPoorRatio) {
+            _minimumLength = MIN(MAX(_minimumLength * 2, PSWebSocketCompressionPolicyMinMinimumLength), PSWebSocketCompressionPolicyMaxMinimumLength);
+        } else if(ratio <= PSWebSocketCompressionPolicyGoodRatio) {
+            _minimumLength = MAX(_minimumLength * 3 / 4, PSWebSocketCompressionPolicyMinMinimumLength);
+        }
+    }
+}
+- (void)resetStatistics {
+    _compressedMessageCount = 0;
+    _skippedMessageCount = 0;
+    _uncompressedByteCount = 0;
+    _compressedByteCount = 0;
+    _compressionTime = 0;
+    _averageRatio = 1.0;
+}
+
+#pragma mark - Private
+
+- (double)sampleEntropyOfBytes:(const void *)bytes length:(NSUInteger)length {
+    // stride through the payload so a compressible header can't hide a compressed body
+    NSUInteger sampleLength = MIN(_sampleLength, length);
+    NSUInteger stride = MAX(length / sampleLength, 1);
+    uint32_t counts[256] = {0};
+    const uint8_t *sampleBytes = (const uint8_t *)bytes;
+    for(NSUInteger i = 0; i < sampleLength; ++i) {
+        ++counts[sampleBytes[i * stride]];
+    }
+    
+    double entropy = 0;
+    for(NSUInteger i = 0; i < 256; ++i) {
+        if(counts[i] > 0) {
+            double p = (double)counts[i] / sampleLength;
+            entropy -= p * log2(p);
+        }
+    }
+    return entropy;
+}
+
+@end
@@ -0,0 +1,92 @@
+//  Copyright 2014 Zwopple Limited
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+/**
+ *  zlib strategies, the values match Z_DEFAULT_STRATEGY through Z_FIXED
+ */
+typedef NS_ENUM(NSInteger, PSWebSocketDeflateStrategy) {
+    PSWebSocketDeflateStrategyDefault = 0,
+    PSWebSocketDeflateStrategyFiltered = 1,
+    PSWebSocketDeflateStrategyHuffmanOnly = 2,
+    PSWebSocketDeflateStrategyRLE = 3,
+    PSWebSocketDeflateStrategyFixed = 4
+};
+
+/**
+ *  zlib settings used for permessage-deflate. Compression level and strategy only
+ *  cost CPU, memory level and window bits decide how much memory each connection
+ *  holds on to: roughly 2^(windowBits + 2) + 2^(memoryLevel + 9) bytes to deflate
+ *  and 2^windowBits bytes to inflate.
+ */
+@interface PSWebSocketDeflateOptions : NSObject <NSCopying>
+
+#pragma mark - Class Methods
+
+/**
+ *  Fastest compression, level 1 with an 11 bit window
+ */
++ (instancetype)lowLatencyOptions;
+
+/**
+ *  The defaults, zlib's default level and strategy with an 11 bit window
+ */
++ (instancetype)balancedOptions;
+
+/**
+ *  Best ratio, level 9 with the largest window and memory level
+ */
++ (instancetype)maxRatioOptions;
+
+/**
+ *  Smallest zlib state, a 9 bit window, memory level 2 and no context takeover
+ */
++ (instancetype)lowMemoryOptions;
+
+#pragma mark - Properties
+
+/**
+ *  Whether permessage-deflate is offered or accepted at all. Defaults to YES.
+ */
+@property (nonatomic, assign, getter=isEnabled) BOOL enabled;
+
+/**
+ *  0 to 9, or -1 for zlib's default of 6. Defaults to -1.
+ */
+@property (nonatomic, assign) NSInteger compressionLevel;
+
+/**
+ *  Defaults to PSWebSocketDeflateStrategyDefault
+ */
+@property (nonatomic, assign) PSWebSocketDeflateStrategy strategy;
+
+/**
+ *  1 to 9, memory used for the deflate hash. Defaults to 8.
+ */
+@property (nonatomic, assign) NSUInteger memoryLevel;
+
+/**
+ *  9 to 15, the largest LZ77 window negotiated for either direction. Defaults to 11.
+ */
+@property (nonatomic, assign) NSUInteger windowBits;
+
+/**
+ *  Start every message we send with a fresh compressor instead of keeping its history,
+ *  freeing its memory between messages. Negotiated as client_no_context_takeover or
+ *  server_no_context_takeover. Defaults to NO.
+ */
+@property (nonatomic, assign) BOOL noContextTakeover;
+
+@end
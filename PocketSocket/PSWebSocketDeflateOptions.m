@@ -0,0 +1,83 @@
+//  Copyright 2014 Zwopple Limited
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#import "PSWebSocketDeflateOptions.h"
+
+@implementation PSWebSocketDeflateOptions
+
+#pragma mark - Class Methods
+
++ (instancetype)lowLatencyOptions {
+    PSWebSocketDeflateOptions *options = [[self alloc] init];
+    options.compressionLevel = 1;
+    return options;
+}
++ (instancetype)balancedOptions {
+    return [[self alloc] init];
+}
++ (instancetype)maxRatioOptions {
+    PSWebSocketDeflateOptions *options = [[self alloc] init];
+    options.compressionLevel = 9;
+    options.memoryLevel = 9;
+    options.windowBits = 15;
+    return options;
+}
++ (instancetype)lowMemoryOptions {
+    PSWebSocketDeflateOptions *options = [[self alloc] init];
+    options.memoryLevel = 2;
+    options.windowBits = 9;
+    options.noContextTakeover = YES;
+    return options;
+}
+
+#pragma mark - Initialization
+
+- (instancetype)init {
+    if((self = [super init])) {
+        _enabled = YES;
+        _compressionLevel = -1;
+        _strategy = PSWebSocketDeflateStrategyDefault;
+        _memoryLevel = 8;
+        _windowBits = 11;
+        _noContextTakeover = NO;
+    }
+    return self;
+}
+
+#pragma mark - Properties
+
+- (void)setCompressionLevel:(NSInteger)compressionLevel {
+    _compressionLevel = MIN(MAX(compressionLevel, -1), 9);
+}
+- (void)setMemoryLevel:(NSUInteger)memoryLevel {
+    _memoryLevel = MIN(MAX(memoryLevel, 1), 9);
+}
+- (void)setWindowBits:(NSUInteger)windowBits {
+    _windowBits = MIN(MAX(windowBits, 9), 15);
+}
+
+#pragma mark - NSCopying
+
+- (id)copyWithZone:(NSZone *)zone {
+    PSWebSocketDeflateOptions *options = [[[self class] allocWithZone:zone] init];
+    options->_enabled = _enabled;
+    options->_compressionLevel = _compressionLevel;
+    options->_strategy = _strategy;
+    options->_memoryLevel = _memoryLevel;
+    options->_windowBits = _windowBits;
+    options->_noContextTakeover = _noContextTakeover;
+    return options;
+}
+
+@end
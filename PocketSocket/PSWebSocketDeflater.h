@@ -19,12 +19,15 @@
 #pragma mark - Initialization
 
 - (instancetype)initWithWindowBits:(NSInteger)windowBits memoryLevel:(NSUInteger)memoryLevel;
+- (instancetype)initWithWindowBits:(NSInteger)windowBits memoryLevel:(NSUInteger)memoryLevel compressionLevel:(NSInteger)compressionLevel strategy:(NSInteger)strategy;
 
 #pragma mark - Actions
 
 - (BOOL)begin:(NSMutableData *)buffer error:(NSError *__autoreleasing *)outError;
 - (BOOL)appendBytes:(const void *)bytes length:(NSUInteger)length error:(NSError *__autoreleasing *)outError;
+- (BOOL)appendBytes:(const void *)bytes length:(NSUInteger)length flush:(BOOL)flush error:(NSError *__autoreleasing *)outError;
 - (BOOL)end:(NSError *__autoreleasing *)outError;
 - (void)reset;
+- (void)purge;
 
 @end
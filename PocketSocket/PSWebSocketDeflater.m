@@ -17,10 +17,17 @@
 #import "PSWebSocketInternal.h"
 #import <zlib.h>
 
+// bytes a sync flush may add on top of deflateBound
+static const NSUInteger PSWebSocketDeflaterFlushLength = 6;
+
+// smallest amount the output buffer is grown by once the bound is exceeded
+static const NSUInteger PSWebSocketDeflaterMinGrowLength = 4096;
+
 @interface PSWebSocketDeflater() {
     NSInteger _windowBits;
     NSUInteger _memoryLevel;
-    uint8_t _chunkBuffer[16384];
+    NSInteger _compressionLevel;
+    NSInteger _strategy;
     z_stream _stream;
     BOOL _ready;
     
@@ -32,13 +39,19 @@
 #pragma mark - Initialization
 
 - (instancetype)initWithWindowBits:(NSInteger)windowBits memoryLevel:(NSUInteger)memoryLevel {
+    return [self initWithWindowBits:windowBits memoryLevel:memoryLevel compressionLevel:Z_DEFAULT_COMPRESSION strategy:Z_DEFAULT_STRATEGY];
+}
+- (instancetype)initWithWindowBits:(NSInteger)windowBits memoryLevel:(NSUInteger)memoryLevel compressionLevel:(NSInteger)compressionLevel strategy:(NSInteger)strategy {
     if((self = [super init])) {
         _windowBits = windowBits;
         _memoryLevel = memoryLevel;
+        _compressionLevel = compressionLevel;
+        _strategy = strategy;
         NSAssert(_windowBits >= -15 && _windowBits <= -1, @"windowBits must be between -15 and -1");
         NSAssert(_memoryLevel >= 1 && _memoryLevel <= 9, @"memory level must be between 1 and 9");
+        NSAssert(_compressionLevel >= Z_DEFAULT_COMPRESSION && _compressionLevel <= Z_BEST_COMPRESSION, @"compression level must be between -1 and 9");
+        NSAssert(_strategy >= Z_DEFAULT_STRATEGY && _strategy <= Z_FIXED, @"strategy must be a zlib strategy");
         bzero(&_stream, sizeof(_stream));
-        bzero(_chunkBuffer, sizeof(_chunkBuffer));
         _ready = NO;
     }
     return self;
@@ -56,24 +69,43 @@
 }
 - (BOOL)appendBytes:(const void *)bytes length:(NSUInteger)length error:(NSError *__autoreleasing *)outError {
     NSParameterAssert(length);
+    return [self appendBytes:bytes length:length flush:YES error:outError];
+}
+- (BOOL)appendBytes:(const void *)bytes length:(NSUInteger)length flush:(BOOL)flush error:(NSError *__autoreleasing *)outError {
+    NSParameterAssert(length || flush);
     
     // set input properties
     _stream.avail_in = (uInt)length;
     _stream.next_in = (Bytef *)bytes;
     
-    // inflate loop
+    // reserve the worst case up front, plus room for the sync flush marker, so
+    // zlib writes straight into the destination in a single pass
+    NSUInteger writtenLength = _buffer.length;
+    NSUInteger capacityLength = deflateBound(&_stream, (uLong)length) + PSWebSocketDeflaterFlushLength;
+    
+    // deflate loop
     do {
+        _buffer.length = writtenLength + capacityLength;
+        
         // set output properties
-        _stream.avail_out = (uInt)sizeof(_chunkBuffer);
-        _stream.next_out = (Bytef *)_chunkBuffer;
+        _stream.avail_out = (uInt)capacityLength;
+        _stream.next_out = (Bytef *)_buffer.mutableBytes + writtenLength;
         
-        deflate(&_stream, Z_SYNC_FLUSH);
+        // without a flush zlib may hold on to the input until a later call
+        int ret = deflate(&_stream, (flush) ? Z_SYNC_FLUSH : Z_NO_FLUSH);
         
-        // determine number of bytes inflated
-        uInt gotBack = sizeof(_chunkBuffer) - _stream.avail_out;
-        if(gotBack > 0) {
-            [_buffer appendBytes:_chunkBuffer length:gotBack];
+        // determine number of bytes deflated
+        writtenLength += capacityLength - _stream.avail_out;
+        _buffer.length = writtenLength;
+        
+        // Z_BUF_ERROR only means no progress was possible, fatal if input was left behind
+        if(ret == Z_STREAM_ERROR || (ret == Z_BUF_ERROR && _stream.avail_in > 0)) {
+            PSWebSocketSetOutError(outError, PSWebSocketStatusCodeProtocolError, @"Failed to deflate bytes");
+            return NO;
         }
+        
+        // input held back by earlier unflushed calls can push past the bound
+        capacityLength = MAX(capacityLength, PSWebSocketDeflaterMinGrowLength);
     } while(_stream.avail_out == 0);
     
     return YES;
@@ -88,11 +120,16 @@
     return YES;
 }
 - (void)reset {
+    _buffer = nil;
+    if(_ready && deflateReset(&_stream) != Z_OK) {
+        [self purge];
+    }
+}
+- (void)purge {
+    _buffer = nil;
     if(_ready) {
-        _buffer = nil;
         deflateEnd(&_stream);
         bzero(&_stream, sizeof(_stream));
-        bzero(_chunkBuffer, sizeof(_chunkBuffer));
         _ready = NO;
     }
 }
@@ -101,7 +138,7 @@
 
 - (BOOL)ensureReady:(NSError *__autoreleasing *)outError {
     if(!_ready) {
-        if(deflateInit2(&_stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, _windowBits, _memoryLevel, Z_FIXED) != Z_OK) {
+        if(deflateInit2(&_stream, (int)_compressionLevel, Z_DEFLATED, (int)_windowBits, (int)_memoryLevel, (int)_strategy) != Z_OK) {
             PSWebSocketSetOutError(outError, PSWebSocketStatusCodeProtocolError, @"Failed to initialize deflate stream");
             return NO;
         }
@@ -113,7 +150,7 @@
 #pragma mark - Dealloc
 
 - (void)dealloc {
-    [self reset];
+    [self purge];
 }
 
 
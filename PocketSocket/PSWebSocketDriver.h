@@ -15,7 +15,16 @@
 #import <Foundation/Foundation.h>
 #import "PSWebSocketTypes.h"
 
+typedef NS_ENUM(NSInteger, PSWebSocketDriverCompression) {
+    PSWebSocketDriverCompressionPolicy = 0,
+    PSWebSocketDriverCompressionAlways,
+    PSWebSocketDriverCompressionNever
+};
+
 @class PSWebSocketDriver;
+@class PSWebSocketCompressionPolicy;
+@class PSWebSocketDeflateOptions;
+@class PSWebSocketPreparedMessage;
 
 @protocol PSWebSocketDriverDelegate <NSObject>
 
@@ -23,11 +32,16 @@
 
 - (void)driverDidOpen:(PSWebSocketDriver *)driver;
 - (void)driver:(PSWebSocketDriver *)driver didReceiveMessage:(id)message;
+- (void)driver:(PSWebSocketDriver *)driver didReceiveTextMessage:(NSData *)utf8Data;
+- (void)driver:(PSWebSocketDriver *)driver didBeginMessage:(BOOL)binary;
+- (void)driver:(PSWebSocketDriver *)driver didReceiveMessageChunk:(NSData *)chunk;
+- (void)driverDidEndMessage:(PSWebSocketDriver *)driver;
 - (void)driver:(PSWebSocketDriver *)driver didReceivePing:(NSData *)ping;
 - (void)driver:(PSWebSocketDriver *)driver didReceivePong:(NSData *)pong;
 - (void)driver:(PSWebSocketDriver *)driver didFailWithError:(NSError *)error;
 - (void)driver:(PSWebSocketDriver *)driver didCloseWithCode:(NSInteger)code reason:(NSString *)reason;
 - (void)driver:(PSWebSocketDriver *)driver write:(NSData *)data;
+- (void)driver:(PSWebSocketDriver *)driver writeHeader:(const void *)header length:(NSUInteger)headerLength payload:(NSData *)payload;
 
 @end
 @interface PSWebSocketDriver : NSObject
@@ -42,6 +56,13 @@
 @property (nonatomic, weak) id <PSWebSocketDriverDelegate> delegate;
 
 @property (nonatomic, strong, readonly) NSString *protocol;
+@property (nonatomic, assign, readonly, getter=isSendingFragments) BOOL sendingFragments;
+@property (nonatomic, assign) BOOL deliversMessageChunks;
+@property (nonatomic, strong) PSWebSocketCompressionPolicy *compressionPolicy;
+@property (nonatomic, copy) PSWebSocketDeflateOptions *deflateOptions;
+@property (nonatomic, assign) NSUInteger maxFrameLength;
+@property (nonatomic, assign) NSUInteger maxMessageLength;
+@property (nonatomic, assign) NSUInteger maxInflatedMessageLength;
 
 #pragma mark - Initialization
 
@@ -53,10 +74,18 @@
 - (void)start;
 - (void)sendText:(NSString *)text;
 - (void)sendBinary:(NSData *)binary;
+- (void)sendText:(NSString *)text compression:(PSWebSocketDriverCompression)compression;
+- (void)sendBinary:(NSData *)binary compression:(PSWebSocketDriverCompression)compression;
+- (void)sendPreparedMessage:(PSWebSocketPreparedMessage *)message;
+- (void)beginFragmentedText;
+- (void)beginFragmentedBinary;
+- (void)sendFragment:(NSData *)data final:(BOOL)final;
 - (void)sendCloseCode:(NSInteger)code reason:(NSString *)reason;
 - (void)sendPing:(NSData *)data;
 - (void)sendPong:(NSData *)data;
+- (void)purgeCompressionState;
 
 - (NSUInteger)execute:(void *)bytes maxLength:(NSUInteger)maxLength;
+- (NSUInteger)execute:(void *)bytes maxLength:(NSUInteger)maxLength storage:(NSData *)storage storageReferenced:(BOOL *)outStorageReferenced;
 
 @end
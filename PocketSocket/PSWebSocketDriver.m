@@ -16,40 +16,46 @@
 #import "PSWebSocketBuffer.h"
 #import "PSWebSocketInflater.h"
 #import "PSWebSocketDeflater.h"
-#import "PSWebSocketBuffer.h"
 #import "PSWebSocketUTF8Decoder.h"
+#import "PSWebSocketMask.h"
+#import "PSWebSocketSubdata.h"
+#import "PSWebSocketCompressionPolicy.h"
+#import "PSWebSocketDeflateOptions.h"
+#import "PSWebSocketPreparedMessage.h"
 #import "PSWebSocketInternal.h"
 #if TARGET_OS_IPHONE
 #import <Endian.h>
 #endif
 #import <CommonCrypto/CommonCrypto.h>
 
-@interface PSWebSocketFrame : NSObject {
-@public
+// the largest possible header: 2 bytes + 8 byte extended length + 4 byte mask key
+static const NSUInteger PSWebSocketMaxFrameHeaderLength = 14;
+
+// the largest payload a control frame may carry
+static const NSUInteger PSWebSocketMaxControlPayloadLength = 125;
+
+// smaller single frame messages are copied rather than pinning the caller's storage,
+// as are payloads under a quarter of the storage so a kept message can't pin much more
+static const NSUInteger PSWebSocketMinSubdataLength = 1024;
+static const NSUInteger PSWebSocketSubdataStorageFraction = 4;
+
+typedef struct {
     BOOL fin;
-    BOOL rsv1;
-    BOOL rsv2;
-    BOOL rsv3;
-    PSWebSocketOpCode opcode;
-    BOOL masked;
-    NSUInteger payloadLength;
     BOOL control;
-    NSUInteger headerExtraLength;
+    BOOL masked;
+    BOOL inflate;
+    BOOL validateUTF8;
+    PSWebSocketOpCode opcode;
+    uint64_t payloadLength;
+    uint64_t payloadRemainingLength;
     uint8_t maskKey[4];
     uint32_t maskOffset;
-    NSMutableData *buffer;
-    NSUInteger payloadRemainingLength;
-}
-@end
-@implementation PSWebSocketFrame
-
-@end
+} PSWebSocketDriverFrame;
 
 typedef NS_ENUM(NSInteger, PSWebSocketDriverState) {
     PSWebSocketDriverStateHandshakeRequest = 0,
     PSWebSocketDriverStateHandshakeResponse,
     PSWebSocketDriverStateFrameHeader,
-    PSWebSocketDriverStateFrameHeaderExtra,
     PSWebSocketDriverStateFramePayload
 };
 
@@ -61,14 +67,30 @@ typedef NS_ENUM(NSInteger, PSWebSocketDriverState) {
     
     NSString *_handshakeSecKey;
     
-    PSWebSocketFrame *_initialFrame;
-    NSMutableArray *_frames;
+    PSWebSocketDriverFrame _frame;
+    
+    PSWebSocketOpCode _messageOpCode;
+    BOOL _messageCompressed;
+    BOOL _messageChunked;
+    uint64_t _messageLength;
+    NSMutableData *_messageBuffer;
+    
+    uint8_t _controlBuffer[PSWebSocketMaxControlPayloadLength];
+    NSUInteger _controlLength;
+    
+    PSWebSocketOpCode _fragmentOpCode;
+    BOOL _fragmentCompressed;
+    BOOL _fragmentStarted;
+    
+    NSData *_storage;
+    BOOL _storageReferenced;
     
     BOOL _pmdEnabled;
     NSInteger _pmdClientWindowBits;
     BOOL _pmdClientNoContextTakeover;
     NSInteger _pmdServerWindowBits;
     BOOL _pmdServerNoContextTakeover;
+    BOOL _pmdClientWindowBitsOffered;
     PSWebSocketInflater *_inflater;
     PSWebSocketDeflater *_deflater;
     
@@ -107,16 +129,22 @@ typedef NS_ENUM(NSInteger, PSWebSocketDriverState) {
         _mode = mode;
         _state = (_mode == PSWebSocketModeClient) ? PSWebSocketDriverStateHandshakeRequest : PSWebSocketDriverStateHandshakeResponse;
         _request = [request mutableCopy];
-        _frames = [NSMutableArray array];
         _utf8DecoderState = 0;
         _utf8DecoderCodePoint = 0;
         _pmdEnabled = YES;
-        _pmdClientWindowBits = -11;
-        _pmdServerWindowBits = -11;
+        _pmdClientWindowBits = -15;
+        _pmdServerWindowBits = -15;
+        _deflateOptions = [[PSWebSocketDeflateOptions alloc] init];
     }
     return self;
 }
 
+#pragma mark - Properties
+
+- (void)setDeflateOptions:(PSWebSocketDeflateOptions *)deflateOptions {
+    _deflateOptions = (deflateOptions) ? [deflateOptions copy] : [[PSWebSocketDeflateOptions alloc] init];
+}
+
 #pragma mark - Actions
 
 - (void)start {
@@ -127,6 +155,13 @@ typedef NS_ENUM(NSInteger, PSWebSocketDriverState) {
     }
 }
 - (NSUInteger)execute:(void *)bytes maxLength:(NSUInteger)maxLength {
+    return [self execute:bytes maxLength:maxLength storage:nil storageReferenced:NULL];
+}
+- (NSUInteger)execute:(void *)bytes maxLength:(NSUInteger)maxLength storage:(NSData *)storage storageReferenced:(BOOL *)outStorageReferenced {
+    if(outStorageReferenced) {
+        *outStorageReferenced = NO;
+    }
+    
     // skip if failed
     if(_failed) {
         return 0;
@@ -140,6 +175,8 @@ typedef NS_ENUM(NSInteger, PSWebSocketDriverState) {
     NSError *error = nil;
     NSInteger bytesRead = 0;
     NSUInteger totalBytesRead = 0;
+    _storage = storage;
+    _storageReferenced = NO;
     while(totalBytesRead < maxLength) {
         bytesRead = [self readBytes:bytes maxLength:maxLength - totalBytesRead error:&error];
         if(bytesRead < 0) {
@@ -155,14 +192,92 @@ typedef NS_ENUM(NSInteger, PSWebSocketDriverState) {
         totalBytesRead += bytesRead;
         bytes += bytesRead;
     }
+    if(outStorageReferenced) {
+        *outStorageReferenced = _storageReferenced;
+    }
+    _storage = nil;
     return totalBytesRead;
 }
 - (void)sendText:(NSString *)text {
-    NSData *data = [text dataUsingEncoding:NSUTF8StringEncoding];
-    [self writeMessageWithOpCode:PSWebSocketOpCodeText data:data];
+    [self sendText:text compression:PSWebSocketDriverCompressionPolicy];
 }
 - (void)sendBinary:(NSData *)binary {
-    [self writeMessageWithOpCode:PSWebSocketOpCodeBinary data:binary];
+    [self sendBinary:binary compression:PSWebSocketDriverCompressionPolicy];
+}
+- (void)sendText:(NSString *)text compression:(PSWebSocketDriverCompression)compression {
+    NSData *data = [text dataUsingEncoding:NSUTF8StringEncoding];
+    [self writeMessageWithOpCode:PSWebSocketOpCodeText data:data compression:compression];
+}
+- (void)sendBinary:(NSData *)binary compression:(PSWebSocketDriverCompression)compression {
+    [self writeMessageWithOpCode:PSWebSocketOpCodeBinary data:binary compression:compression];
+}
+- (void)sendPreparedMessage:(PSWebSocketPreparedMessage *)message {
+    NSAssert(!_sendingFragments, @"Cannot send a data message while a fragmented message is being sent");
+    
+    PSWebSocketOpCode opcode = (message.binary) ? PSWebSocketOpCodeBinary : PSWebSocketOpCodeText;
+    
+    // the shared payload was deflated from scratch so it suits any window at least as large
+    NSData *deflated = nil;
+    if(_pmdEnabled) {
+        NSInteger windowBits = (_mode == PSWebSocketModeServer) ? _pmdServerWindowBits : _pmdClientWindowBits;
+        deflated = [message deflatedDataWithWindowBits:-windowBits];
+    }
+    if(!deflated) {
+        [self writeFrameWithOpCode:opcode fin:YES rsv1:NO payload:message.data data:message.data];
+        return;
+    }
+    
+    // the peer's window now holds bytes our deflater never saw so its history can't be used again
+    if(!((_pmdClientNoContextTakeover && _mode == PSWebSocketModeClient) ||
+         (_pmdServerNoContextTakeover && _mode == PSWebSocketModeServer))) {
+        [_deflater reset];
+    }
+    
+    [self writeFrameWithOpCode:opcode fin:YES rsv1:YES payload:deflated data:deflated];
+}
+- (void)beginFragmentedText {
+    [self beginFragmentedMessageWithOpCode:PSWebSocketOpCodeText];
+}
+- (void)beginFragmentedBinary {
+    [self beginFragmentedMessageWithOpCode:PSWebSocketOpCodeBinary];
+}
+- (void)sendFragment:(NSData *)data final:(BOOL)final {
+    NSAssert(_sendingFragments, @"Must begin a fragmented message before sending fragments");
+    if(!_sendingFragments) {
+        return;
+    }
+    
+    // the first frame carries the opcode, every frame after it is a continuation
+    PSWebSocketOpCode opcode = (_fragmentStarted) ? PSWebSocketOpCodeContinuation : _fragmentOpCode;
+    id payload = data;
+    
+    // deflate payload, only flushing the deflater at the end of the message so
+    // the compression context carries across fragments
+    if(_fragmentCompressed) {
+        payload = [self deflateBytes:[data bytes] length:[data length] flush:final];
+        if(!payload) {
+            return;
+        }
+    }
+    
+    // rsv1 is only set on the first frame of a compressed message
+    BOOL rsv1 = (_fragmentCompressed && !_fragmentStarted);
+    _fragmentStarted = YES;
+    if(final) {
+        _sendingFragments = NO;
+        if(_fragmentCompressed) {
+            [self releaseDeflaterIfNoContextTakeover];
+        }
+    }
+    
+    [self writeFrameWithOpCode:opcode fin:final rsv1:rsv1 payload:payload data:data];
+}
+- (void)releaseDeflaterIfNoContextTakeover {
+    // configured not to keep history, so free the stream between messages and let
+    // the next compressed message build a fresh one
+    if(_deflateOptions.noContextTakeover) {
+        [_deflater purge];
+    }
 }
 - (void)sendCloseCode:(NSInteger)code reason:(NSString *)reason {
     NSUInteger reasonMaxLength = [reason maximumLengthOfBytesUsingEncoding:NSUTF8StringEncoding];
@@ -193,6 +308,23 @@ typedef NS_ENUM(NSInteger, PSWebSocketDriverState) {
 - (void)sendPong:(NSData *)data {
     [self writeMessageWithOpCode:PSWebSocketOpCodePong data:data];
 }
+- (void)purgeCompressionState {
+    if(!_pmdEnabled) {
+        return;
+    }
+    
+    // dropping our own history only costs ratio on the next message
+    if(!_sendingFragments) {
+        [_deflater purge];
+    }
+    
+    // the peer's history can only be dropped if it doesn't rely on it either
+    if(!_messageBuffer &&
+       ((_pmdClientNoContextTakeover && _mode == PSWebSocketModeServer) ||
+        (_pmdServerNoContextTakeover && _mode == PSWebSocketModeClient))) {
+        [_inflater purge];
+    }
+}
 
 #pragma mark - Writing
 
@@ -293,63 +425,115 @@ typedef NS_ENUM(NSInteger, PSWebSocketDriverState) {
     // open
     [_delegate driverDidOpen:self];
 }
-- (void)writeMessageWithOpCode:(PSWebSocketOpCode)opcode data:(NSData *)data {
-    // create header
-    NSMutableData *header = [NSMutableData dataWithLength:2];
-    uint8_t *headerBytes = header.mutableBytes;
+- (void)beginFragmentedMessageWithOpCode:(PSWebSocketOpCode)opcode {
+    NSAssert(!_sendingFragments, @"Cannot begin a fragmented message while another is being sent");
+    _sendingFragments = YES;
+    _fragmentOpCode = opcode;
+    _fragmentStarted = NO;
+    _fragmentCompressed = _pmdEnabled;
     
-    headerBytes[0] |= PSWebSocketFinMask;
-    //  headerBytes[0] |= (ZWPWebSocketRsv2Mask);
-    //  headerBytes[0] |= (ZWPWebSocketRsv3Mask);
-    headerBytes[0] |= (PSWebSocketOpCodeMask & opcode);
+    // reset deflater if needed
+    if(_fragmentCompressed &&
+       ((_pmdClientNoContextTakeover && _mode == PSWebSocketModeClient) ||
+        (_pmdServerNoContextTakeover && _mode == PSWebSocketModeServer))) {
+        [_deflater reset];
+    }
+}
+- (void)writeMessageWithOpCode:(PSWebSocketOpCode)opcode data:(NSData *)data {
+    [self writeMessageWithOpCode:opcode data:data compression:PSWebSocketDriverCompressionNever];
+}
+- (void)writeMessageWithOpCode:(PSWebSocketOpCode)opcode data:(NSData *)data compression:(PSWebSocketDriverCompression)compression {
+    NSAssert(!_sendingFragments || PSWebSocketOpCodeIsControl(opcode), @"Cannot send a data message while a fragmented message is being sent");
     
     // determine payload payload
     id payload = data;
+    BOOL rsv1 = NO;
+    
+    // decide whether the payload is worth deflating
+    BOOL compress = (_pmdEnabled && !PSWebSocketOpCodeIsControl(opcode) && [payload length] > 0);
+    if(compress && compression == PSWebSocketDriverCompressionNever) {
+        compress = NO;
+    } else if(compress && compression == PSWebSocketDriverCompressionPolicy && _compressionPolicy) {
+        compress = [_compressionPolicy shouldCompressBytes:[data bytes] length:[data length]];
+    }
     
     // deflate payload
-    if(_pmdEnabled && !PSWebSocketOpCodeIsControl(opcode) && [payload length] > 0) {
+    if(compress) {
         // reset deflater if needed
         if((_pmdClientNoContextTakeover && _mode == PSWebSocketModeClient) ||
            (_pmdServerNoContextTakeover && _mode == PSWebSocketModeServer)) {
             [_deflater reset];
         }
         
-        // create deflate buffer
-        NSMutableData *deflated = [NSMutableData dataWithCapacity:ceil([payload length]/4.0)];
-        
-        // error
-        NSError *error = nil;
-        
-        // begin deflater
-        if(![_deflater begin:deflated error:&error]) {
-            NSAssert(NO, error.localizedDescription);
-            [self failWithError:error];
-            [_deflater reset];
-            return;
-        }
-        
-        // append bytes
-        if(![_deflater appendBytes:[payload bytes] length:[payload length] error:&error]) {
-            NSAssert(NO, error.localizedDescription);
-            [self failWithError:error];
-            [_deflater reset];
+        // reassign data
+        CFAbsoluteTime start = (_compressionPolicy) ? CFAbsoluteTimeGetCurrent() : 0;
+        payload = [self deflateBytes:[data bytes] length:[data length] flush:YES];
+        if(!payload) {
             return;
         }
-        
-        // end deflater
-        if(![_deflater end:&error]) {
-            NSAssert(NO, error.localizedDescription);
-            [self failWithError:error];
-            [_deflater reset];
-            return;
+        if(_compressionPolicy) {
+            [_compressionPolicy recordCompressionOfLength:[data length] compressedLength:[payload length] duration:CFAbsoluteTimeGetCurrent() - start];
         }
-        
-        // reassign data
-        payload = deflated;
+        [self releaseDeflaterIfNoContextTakeover];
         
         // set rsv1 mask
+        rsv1 = YES;
+    }
+    
+    [self writeFrameWithOpCode:opcode fin:YES rsv1:rsv1 payload:payload data:data];
+}
+- (NSMutableData *)deflateBytes:(const void *)bytes length:(NSUInteger)length flush:(BOOL)flush {
+    // nothing to deflate and nothing to flush
+    if(length == 0 && !flush) {
+        return [NSMutableData data];
+    }
+    
+    // create deflate buffer, the deflater sizes it from deflateBound
+    NSMutableData *deflated = [NSMutableData data];
+    
+    // error
+    NSError *error = nil;
+    
+    // begin deflater
+    if(![_deflater begin:deflated error:&error]) {
+        NSAssert(NO, error.localizedDescription);
+        [self failWithError:error];
+        [_deflater purge];
+        return nil;
+    }
+    
+    // append bytes
+    if(![_deflater appendBytes:bytes length:length flush:flush error:&error]) {
+        NSAssert(NO, error.localizedDescription);
+        [self failWithError:error];
+        [_deflater purge];
+        return nil;
+    }
+    
+    // end deflater, stripping the sync flush trailer
+    if(flush && ![_deflater end:&error]) {
+        NSAssert(NO, error.localizedDescription);
+        [self failWithError:error];
+        [_deflater purge];
+        return nil;
+    }
+    
+    return deflated;
+}
+- (void)writeFrameWithOpCode:(PSWebSocketOpCode)opcode fin:(BOOL)fin rsv1:(BOOL)rsv1 payload:(id)payload data:(NSData *)data {
+    // create header
+    uint8_t headerBytes[PSWebSocketMaxFrameHeaderLength] = {0};
+    NSUInteger headerLength = 2;
+    
+    if(fin) {
+        headerBytes[0] |= PSWebSocketFinMask;
+    }
+    if(rsv1) {
         headerBytes[0] |= PSWebSocketRsv1Mask;
     }
+    //  headerBytes[0] |= (ZWPWebSocketRsv2Mask);
+    //  headerBytes[0] |= (ZWPWebSocketRsv3Mask);
+    headerBytes[0] |= (PSWebSocketOpCodeMask & opcode);
     
     // set payload length data
     if([payload length] < 126) {
@@ -357,11 +541,13 @@ typedef NS_ENUM(NSInteger, PSWebSocketDriverState) {
     } else if([payload length] <= UINT16_MAX) {
         headerBytes[1] |= 126;
         uint16_t len = EndianU16_BtoN((uint16_t)[payload length]);
-        [header appendBytes:&len length:sizeof(len)];
+        memcpy(headerBytes + headerLength, &len, sizeof(len));
+        headerLength += sizeof(len);
     } else {
         headerBytes[1] |= 127;
         uint64_t len = EndianU64_BtoN((uint64_t)[payload length]);
-        [header appendBytes:&len length:sizeof(len)];
+        memcpy(headerBytes + headerLength, &len, sizeof(len));
+        headerLength += sizeof(len);
     }
     
     // set masking data
@@ -370,23 +556,21 @@ typedef NS_ENUM(NSInteger, PSWebSocketDriverState) {
         
         uint8_t maskKey[4];
         SecRandomCopyBytes(kSecRandomDefault, sizeof(maskKey), maskKey);
-        [header appendBytes:maskKey length:sizeof(maskKey)];
-        
-        // make copy if not already mutable
-        if(![payload isKindOfClass:[NSMutableData class]]) {
-            payload = [payload mutableCopy];
-        }
+        memcpy(headerBytes + headerLength, maskKey, sizeof(maskKey));
+        headerLength += sizeof(maskKey);
         
-        // mask payload inplace
-        uint8_t *payloadBytes = (uint8_t *)[payload mutableBytes];
-        for(NSUInteger i = 0; i < [payload length]; ++i) {
-            payloadBytes[i] = payloadBytes[i] ^ maskKey[i % sizeof(maskKey)];
+        // mask inplace if we own the payload, otherwise mask into a copy
+        if(payload != data) {
+            PSWebSocketMaskBytes((uint8_t *)[payload mutableBytes], [payload length], maskKey, 0);
+        } else {
+            NSMutableData *masked = [NSMutableData dataWithLength:[payload length]];
+            PSWebSocketMaskBytesCopy((uint8_t *)masked.mutableBytes, (const uint8_t *)[payload bytes], [payload length], maskKey, 0);
+            payload = masked;
         }
     }
     
-    // write data to delegate
-    [_delegate driver:self write:header];
-    [_delegate driver:self write:payload];
+    // write frame to delegate, the payload is queued by reference
+    [_delegate driver:self writeHeader:headerBytes length:headerLength payload:payload];
 }
 
 #pragma mark - Reading
@@ -503,11 +687,17 @@ typedef NS_ENUM(NSInteger, PSWebSocketDriverState) {
             PSWebSocketOpCode opcode = (header[0] & PSWebSocketOpCodeMask);
             BOOL masked = !!(header[1] & PSWebSocketMaskMask);
             uint64_t payloadLength = (header[1] & PSWebSocketPayloadLenMask);
-            uint32_t headerExtraLength = (masked) ? sizeof(uint32_t) : 0;
+            NSUInteger headerLength = 2 + ((masked) ? sizeof(uint32_t) : 0);
             if(payloadLength == 126) {
-                headerExtraLength += sizeof(uint16_t);
+                headerLength += sizeof(uint16_t);
             } else if(payloadLength == 127) {
-                headerExtraLength += sizeof(uint64_t);
+                headerLength += sizeof(uint64_t);
+            }
+            NSAssert(headerLength <= PSWebSocketMaxFrameHeaderLength, @"Frame header length out of range");
+            
+            // wait until the whole header is available
+            if(maxLength < headerLength) {
+                return 0;
             }
             
             // validate opcode
@@ -540,12 +730,12 @@ typedef NS_ENUM(NSInteger, PSWebSocketDriverState) {
             // validate data frame
             else {
                 // data continuation frames must follow an initial data frame
-                if(opcode == PSWebSocketOpCodeContinuation && _frames.count == 0) {
+                if(opcode == PSWebSocketOpCodeContinuation && !_messageBuffer) {
                     PSWebSocketSetOutError(outError, PSWebSocketStatusCodeProtocolError, @"Data continuation frames must follow an initial data frame");
                     return -1;
                 }
                 // non data continuation frames must not follow an initial data frame
-                if(opcode != PSWebSocketOpCodeContinuation && _frames.count > 0) {
+                if(opcode != PSWebSocketOpCodeContinuation && _messageBuffer) {
                     PSWebSocketSetOutError(outError, PSWebSocketStatusCodeProtocolError, @"Data frames must not follow an initial data frame unless continuations");
                     return -1;
                 }
@@ -572,77 +762,136 @@ typedef NS_ENUM(NSInteger, PSWebSocketDriverState) {
                 return -1;
             }
             
-            // create frame
-            PSWebSocketFrame *frame = [[PSWebSocketFrame alloc] init];
-            frame->fin = fin;
-            frame->rsv1 = rsv1;
-            frame->rsv2 = rsv2;
-            frame->rsv3 = rsv3;
-            frame->opcode = opcode;
-            frame->masked = masked;
-            frame->payloadLength = (NSUInteger)payloadLength;
-            frame->payloadRemainingLength = (NSUInteger)payloadLength;
-            frame->headerExtraLength = headerExtraLength;
-            frame->control = control;
-            
-            if(!frame->control && _frames.count > 0) {
-                _initialFrame = [_frames lastObject];
-                frame->opcode = _initialFrame->opcode;
-                frame->buffer = _initialFrame->buffer;
-            } else {
-                frame->buffer = [NSMutableData data];
+            // extended payload length
+            const uint8_t *extra = header + 2;
+            if(payloadLength == 126) {
+                uint16_t length;
+                memcpy(&length, extra, sizeof(length));
+                payloadLength = EndianU16_BtoN(length);
+                extra += sizeof(length);
+            } else if(payloadLength == 127) {
+                uint64_t length;
+                memcpy(&length, extra, sizeof(length));
+                payloadLength = EndianU64_BtoN(length);
+                extra += sizeof(length);
+                
+                // the most significant bit must be 0
+                if(payloadLength & (1ULL << 63)) {
+                    PSWebSocketSetOutError(outError, PSWebSocketStatusCodeProtocolError, @"Invalid payload length");
+                    return -1;
+                }
+                if((uint64_t)(NSUInteger)payloadLength != payloadLength) {
+                    PSWebSocketSetOutError(outError, PSWebSocketStatusCodeMessageTooBig, @"Payload length too large");
+                    return -1;
+                }
             }
-            [_frames addObject:frame];
             
-            if(headerExtraLength > 0) {
-                _state = PSWebSocketDriverStateFrameHeaderExtra;
-            } else if(payloadLength > 0) {
-                _state = PSWebSocketDriverStateFramePayload;
-            } else {
-                _state = PSWebSocketDriverStateFrameHeader;
-                if(![self processFramesAndDelegate:outError]) {
+            // enforce size limits before a single payload byte is buffered
+            if(_maxFrameLength > 0 && payloadLength > _maxFrameLength) {
+                PSWebSocketSetOutError(outError, PSWebSocketStatusCodeMessageTooBig, @"Frame too large");
+                return -1;
+            }
+            uint64_t messageLength = 0;
+            if(!control) {
+                messageLength = (opcode == PSWebSocketOpCodeContinuation) ? _messageLength : 0;
+                if(_maxMessageLength > 0 && payloadLength > _maxMessageLength - messageLength) {
+                    PSWebSocketSetOutError(outError, PSWebSocketStatusCodeMessageTooBig, @"Message too large");
                     return -1;
                 }
+                messageLength += payloadLength;
             }
-            return 2;
-        }
-        //
-        // FRAME HEADER EXTRA
-        //
-        case PSWebSocketDriverStateFrameHeaderExtra: {
-            NSAssert(maxLength > 0, @"Must have 1 or more bytes");
             
-            // get current frame
-            PSWebSocketFrame *frame = [_frames lastObject];
+            // deliver whole unfragmented uncompressed messages straight from the input bytes
+            if(fin && !control && !rsv1 && opcode != PSWebSocketOpCodeContinuation &&
+               payloadLength > 0 && payloadLength <= maxLength - headerLength) {
+                uint8_t *payload = (uint8_t *)bytes + headerLength;
+                NSUInteger length = (NSUInteger)payloadLength;
+                if(masked) {
+                    PSWebSocketMaskBytes(payload, length, extra, 0);
+                }
+                if(opcode == PSWebSocketOpCodeText) {
+                    uint32_t state = PSWebSocketUTF8DecoderAccept;
+                    uint32_t codePoint = 0;
+                    if(PSWebSocketUTF8DecoderValidate(&state, &codePoint, payload, length) != PSWebSocketUTF8DecoderAccept) {
+                        PSWebSocketSetOutError(outError, PSWebSocketStatusCodeInvalidUTF8, @"Invalid UTF-8");
+                        return -1;
+                    }
+                }
+                
+                if(_deliversMessageChunks) {
+                    [_delegate driver:self didBeginMessage:(opcode == PSWebSocketOpCodeBinary)];
+                    [self delegateMessageChunkBytes:payload length:length];
+                    [_delegate driverDidEndMessage:self];
+                    return headerLength + length;
+                }
+                
+                NSData *message = nil;
+                if([self shouldReferenceStorageForLength:length]) {
+                    message = [PSWebSocketSubdata subdataWithStorage:_storage bytes:payload length:length];
+                    _storageReferenced = YES;
+                } else {
+                    message = [NSData dataWithBytes:payload length:length];
+                }
+                
+                if(opcode == PSWebSocketOpCodeText) {
+                    [_delegate driver:self didReceiveTextMessage:message];
+                } else {
+                    [_delegate driver:self didReceiveMessage:message];
+                }
+                return headerLength + length;
+            }
             
-            // we need at least current frames header extra length
-            if(maxLength < frame->headerExtraLength) {
-                return 0;
+            // begin a new message if this is an initial data frame
+            if(control) {
+                _controlLength = 0;
+            } else if(opcode != PSWebSocketOpCodeContinuation) {
+                _messageOpCode = opcode;
+                _messageCompressed = rsv1;
+                _messageBuffer = [NSMutableData data];
+                if(_messageCompressed) {
+                    // reset inflater if we need to
+                    if((_pmdClientNoContextTakeover && _mode == PSWebSocketModeServer) ||
+                       (_pmdServerNoContextTakeover && _mode == PSWebSocketModeClient)) {
+                        [_inflater reset];
+                    }
+                    _inflater.outputLimit = (_maxInflatedMessageLength > 0) ? _maxInflatedMessageLength : NSUIntegerMax;
+                    if(![_inflater begin:_messageBuffer error:outError]) {
+                        return -1;
+                    }
+                }
+                _messageChunked = _deliversMessageChunks;
+                if(_messageChunked) {
+                    [_delegate driver:self didBeginMessage:(opcode == PSWebSocketOpCodeBinary)];
+                }
             }
             
-            uint64_t payloadLength = frame->payloadLength;
-            if(payloadLength == 126) {
-                payloadLength = EndianU16_BtoN(*(uint16_t *)bytes);
-            } else if(payloadLength == 127) {
-                payloadLength = EndianU64_BtoN(*(uint64_t *)bytes);
+            if(!control) {
+                _messageLength = messageLength;
             }
-            frame->payloadLength = (NSUInteger)payloadLength;
-            frame->payloadRemainingLength = (NSUInteger)payloadLength;
             
-            if(frame->masked) {
-                memcpy(frame->maskKey, (uint8_t *)bytes + (frame->headerExtraLength - sizeof(uint32_t)), sizeof(uint32_t));
-                frame->maskOffset = 0;
+            // set frame state, deciding once what each chunk of payload needs
+            _frame.fin = fin;
+            _frame.control = control;
+            _frame.masked = masked;
+            _frame.inflate = (!control && _messageCompressed);
+            _frame.validateUTF8 = (!control && _messageOpCode == PSWebSocketOpCodeText);
+            _frame.opcode = opcode;
+            _frame.payloadLength = payloadLength;
+            _frame.payloadRemainingLength = payloadLength;
+            if(masked) {
+                memcpy(_frame.maskKey, extra, sizeof(_frame.maskKey));
+                _frame.maskOffset = 0;
             }
             
-            if(frame->payloadLength > 0) {
+            if(payloadLength > 0) {
                 _state = PSWebSocketDriverStateFramePayload;
             } else {
                 _state = PSWebSocketDriverStateFrameHeader;
-                if(![self processFramesAndDelegate:outError]) {
+                if(![self processFrameAndDelegate:outError]) {
                     return -1;
                 }
             }
-            return frame->headerExtraLength;
+            return headerLength;
         }
         //
         // FRAME PAYLOAD
@@ -650,80 +899,58 @@ typedef NS_ENUM(NSInteger, PSWebSocketDriverState) {
         case PSWebSocketDriverStateFramePayload: {
             NSAssert(maxLength > 0, @"Must have 1 or more bytes");
             
-            // get current frame
-            PSWebSocketFrame *frame = [_frames lastObject];
-            
-            NSUInteger consumeLength = MIN(frame->payloadRemainingLength, maxLength);
-            NSUInteger offset = frame->buffer.length;
+            NSUInteger consumeLength = (NSUInteger)MIN(_frame.payloadRemainingLength, (uint64_t)maxLength);
             
             // unmask bytes if client -> server
-            if(_mode == PSWebSocketModeServer) {
-                uint8_t *unmaskedBytes = (uint8_t *)bytes;
-                uint8_t *maskKey = frame->maskKey;
-                for(NSInteger i = 0; i < consumeLength; ++i) {
-                    unmaskedBytes[i] = unmaskedBytes[i] ^ maskKey[frame->maskOffset++ % sizeof(uint32_t)];
-                }
+            if(_frame.masked) {
+                _frame.maskOffset = PSWebSocketMaskBytes((uint8_t *)bytes, consumeLength, _frame.maskKey, _frame.maskOffset);
             }
             
-            // inflate if necessary
-            if(_pmdEnabled && !frame->control && (frame->rsv1 || _initialFrame->rsv1)) {
-                // reset inflater if we need to
-                if((_pmdClientNoContextTakeover && _mode == PSWebSocketModeServer) ||
-                   (_pmdServerNoContextTakeover && _mode == PSWebSocketModeClient)) {
-                    [_inflater reset];
+            // control payloads are collected inline
+            if(_frame.control) {
+                memcpy(_controlBuffer + _controlLength, bytes, consumeLength);
+                _controlLength += consumeLength;
+            }
+            // uncompressed chunks go up straight from the input bytes
+            else if(_messageChunked && !_frame.inflate) {
+                if(_frame.validateUTF8 && ![self validateUTF8Bytes:bytes length:consumeLength error:outError]) {
+                    return -1;
                 }
-                
-                // begin the inflater
-                if(frame->payloadLength == frame->payloadRemainingLength) {
-                    if(![_inflater begin:frame->buffer error:outError]) {
+                [self delegateMessageChunkBytes:bytes length:consumeLength];
+            }
+            // data payloads go to the message buffer
+            else {
+                NSUInteger offset = _messageBuffer.length;
+                if(_frame.inflate) {
+                    if(![_inflater appendBytes:bytes length:consumeLength error:outError]) {
                         return -1;
                     }
+                } else {
+                    [_messageBuffer appendBytes:bytes length:consumeLength];
                 }
                 
-                // inflate bytes
-                if(![_inflater appendBytes:bytes length:consumeLength error:outError]) {
+                // validate utf-8 if necessary
+                if(_frame.validateUTF8 && ![self validateUTF8FromOffset:offset error:outError]) {
                     return -1;
                 }
                 
-                // end inflater
-                if(frame->fin && frame->payloadRemainingLength == consumeLength) {
-                    if(![_inflater end:outError]) {
+                // hand up whatever was inflated and start the next chunk
+                if(_messageChunked && _messageBuffer.length > 0) {
+                    NSMutableData *chunk = _messageBuffer;
+                    _messageBuffer = [NSMutableData data];
+                    if(![_inflater begin:_messageBuffer error:outError]) {
                         return -1;
                     }
-                }
-            }
-            // otherwise append
-            else {
-                [frame->buffer appendBytes:bytes length:consumeLength];
-            }
-            
-            // validate utf-8 if necessary
-            if(frame->opcode == PSWebSocketOpCodeText) {
-                uint8_t *bytes = (uint8_t *)(frame->buffer.bytes + offset);
-                for(NSUInteger i = 0; i < frame->buffer.length - offset; ++i) {
-                    // get validation result
-                    PSWebSocketUTF8DecoderDecode(&_utf8DecoderState, &_utf8DecoderCodePoint, *(bytes + i));
-                    
-                    // read bad code point
-                    if(_utf8DecoderState == PSWebSocketUTF8DecoderReject) {
-                        PSWebSocketSetOutError(outError, PSWebSocketStatusCodeInvalidUTF8, @"Invalid UTF-8");
-                        return -1;
-                    }
-                }
-                
-                // need more bytes & no data will be left
-                if(_utf8DecoderState > 1 && frame->fin && frame->payloadRemainingLength - consumeLength == 0) {
-                    PSWebSocketSetOutError(outError, PSWebSocketStatusCodeInvalidUTF8, @"Invalid UTF-8");
-                    return -1;
+                    [_delegate driver:self didReceiveMessageChunk:chunk];
                 }
             }
             
             // remove consumed length from remaining payload length
-            frame->payloadRemainingLength -= consumeLength;
+            _frame.payloadRemainingLength -= consumeLength;
             
-            if(frame->payloadRemainingLength == 0) {
+            if(_frame.payloadRemainingLength == 0) {
                 _state = PSWebSocketDriverStateFrameHeader;
-                if(![self processFramesAndDelegate:outError]) {
+                if(![self processFrameAndDelegate:outError]) {
                     return -1;
                 }
             }
@@ -735,74 +962,120 @@ typedef NS_ENUM(NSInteger, PSWebSocketDriverState) {
     return 0;
 }
 
-- (BOOL)processFramesAndDelegate:(NSError *__autoreleasing *)outError {
-    // get current frame
-    PSWebSocketFrame *frame = [_frames lastObject];
+- (BOOL)validateUTF8FromOffset:(NSUInteger)offset error:(NSError *__autoreleasing *)outError {
+    return [self validateUTF8Bytes:(const uint8_t *)_messageBuffer.bytes + offset length:_messageBuffer.length - offset error:outError];
+}
+- (BOOL)validateUTF8Bytes:(const void *)bytes length:(NSUInteger)length error:(NSError *__autoreleasing *)outError {
+    if(PSWebSocketUTF8DecoderValidate(&_utf8DecoderState, &_utf8DecoderCodePoint, bytes, length) == PSWebSocketUTF8DecoderReject) {
+        PSWebSocketSetOutError(outError, PSWebSocketStatusCodeInvalidUTF8, @"Invalid UTF-8");
+        return NO;
+    }
+    return YES;
+}
+- (BOOL)shouldReferenceStorageForLength:(NSUInteger)length {
+    return (_storage &&
+            length >= PSWebSocketMinSubdataLength &&
+            length >= _storage.length / PSWebSocketSubdataStorageFraction);
+}
+- (void)delegateMessageChunkBytes:(const void *)bytes length:(NSUInteger)length {
+    NSData *chunk = nil;
+    if([self shouldReferenceStorageForLength:length]) {
+        chunk = [PSWebSocketSubdata subdataWithStorage:_storage bytes:bytes length:length];
+        _storageReferenced = YES;
+    } else {
+        chunk = [NSData dataWithBytes:bytes length:length];
+    }
+    [_delegate driver:self didReceiveMessageChunk:chunk];
+}
+- (BOOL)processFrameAndDelegate:(NSError *__autoreleasing *)outError {
+    // control frames
+    if(_frame.control) {
+        switch(_frame.opcode) {
+            case PSWebSocketOpCodePing:
+                [_delegate driver:self didReceivePing:[NSData dataWithBytes:_controlBuffer length:_controlLength]];
+                break;
+            case PSWebSocketOpCodePong:
+                [_delegate driver:self didReceivePong:[NSData dataWithBytes:_controlBuffer length:_controlLength]];
+                break;
+            case PSWebSocketOpCodeClose:
+                if(_controlLength >= 2) {
+                    uint16_t closeCode = 0;
+                    memcpy(&closeCode, _controlBuffer, sizeof(closeCode));
+                    closeCode = EndianU16_BtoN(closeCode);
+                    if(!PSWebSocketCloseCodeIsValid(closeCode)) {
+                        PSWebSocketSetOutError(outError, PSWebSocketStatusCodeProtocolError, @"Invalid close code");
+                        return NO;
+                    }
+                    NSString *reason = nil;
+                    if(_controlLength > 2) {
+                        reason = [[NSString alloc] initWithBytes:_controlBuffer + sizeof(uint16_t)
+                                                          length:_controlLength - sizeof(uint16_t)
+                                                        encoding:NSUTF8StringEncoding];
+                        if(!reason) {
+                            PSWebSocketSetOutError(outError, PSWebSocketStatusCodeProtocolError, @"Invalid close reason; must be UTF-8");
+                            return NO;
+                        }
+                    }
+                    [_delegate driver:self didCloseWithCode:closeCode reason:reason];
+                } else if(_controlLength >= 1) {
+                    PSWebSocketSetOutError(outError, PSWebSocketStatusCodeProtocolError, @"Invalid close payload");
+                    return NO;
+                } else {
+                    [_delegate driver:self didCloseWithCode:PSWebSocketStatusCodeNoStatusReceived reason:nil];
+                }
+                break;
+            default:
+                break;
+        }
+        return YES;
+    }
     
     // skip if not final
-    if(!frame->fin) {
+    if(!_frame.fin) {
         return YES;
     }
     
-    // remove frames
-    if(frame->control) {
-        [_frames removeLastObject];
-    } else {
-        [_frames removeAllObjects];
-        _initialFrame = nil;
-        _utf8DecoderState = 0;
-        _utf8DecoderCodePoint = 0;
+    // end inflater
+    if(_frame.inflate) {
+        NSUInteger offset = _messageBuffer.length;
+        if(![_inflater end:outError]) {
+            return NO;
+        }
+        if(_frame.validateUTF8 && ![self validateUTF8FromOffset:offset error:outError]) {
+            return NO;
+        }
+    }
+    
+    // text messages must not end part way through a sequence
+    if(_frame.validateUTF8 && _utf8DecoderState != PSWebSocketUTF8DecoderAccept) {
+        PSWebSocketSetOutError(outError, PSWebSocketStatusCodeInvalidUTF8, @"Invalid UTF-8");
+        return NO;
+    }
+    
+    // finish message
+    NSMutableData *message = _messageBuffer;
+    _messageBuffer = nil;
+    _utf8DecoderState = 0;
+    _utf8DecoderCodePoint = 0;
+    
+    if(_messageChunked) {
+        if(message.length > 0) {
+            [_delegate driver:self didReceiveMessageChunk:message];
+        }
+        [_delegate driverDidEndMessage:self];
+        return YES;
     }
     
-    switch(frame->opcode) {
+    switch(_messageOpCode) {
         case PSWebSocketOpCodeBinary:
-            [_delegate driver:self didReceiveMessage:frame->buffer];
-            break;
-        case PSWebSocketOpCodePong:
-            [_delegate driver:self didReceivePong:frame->buffer];
+            [_delegate driver:self didReceiveMessage:message];
             break;
-        case PSWebSocketOpCodePing: {
-            [_delegate driver:self didReceivePing:frame->buffer];
+        case PSWebSocketOpCodeText:
+            // every byte has already been through the utf-8 validator so hand up the raw bytes
+            [_delegate driver:self didReceiveTextMessage:message];
             break;
-        }
-        case PSWebSocketOpCodeText: {
-            NSString *utf8 = [[NSString alloc] initWithData:frame->buffer encoding:NSUTF8StringEncoding];
-            if(!utf8) {
-                PSWebSocketSetOutError(outError, PSWebSocketStatusCodeInvalidUTF8, @"Invalid UTF-8");
-                return NO;
-            }
-            [_delegate driver:self didReceiveMessage:utf8];
-            break;
-        }
-        case PSWebSocketOpCodeClose:
-            if(frame->buffer.length >= 2) {
-                uint16_t closeCode = 0;
-                [frame->buffer getBytes:&closeCode length:sizeof(closeCode)];
-                closeCode = EndianU16_BtoN(closeCode);
-                if(!PSWebSocketCloseCodeIsValid(closeCode)) {
-                    PSWebSocketSetOutError(outError, PSWebSocketStatusCodeProtocolError, @"Invalid close code");
-                    return NO;
-                }
-                NSString *reason = nil;
-                if(frame->buffer.length > 2) {
-                    reason = [[NSString alloc] initWithBytes:frame->buffer.mutableBytes + sizeof(uint16_t)
-                                                      length:frame->buffer.length - sizeof(uint16_t)
-                                                    encoding:NSUTF8StringEncoding];
-                    if(!reason) {
-                        PSWebSocketSetOutError(outError, PSWebSocketStatusCodeProtocolError, @"Invalid close reason; must be UTF-8");
-                        return NO;
-                    }
-                }
-                [_delegate driver:self didCloseWithCode:closeCode reason:reason];
-            } else if(frame->buffer.length >= 1) {
-                PSWebSocketSetOutError(outError, PSWebSocketStatusCodeProtocolError, @"Invalid close payload");
-                return NO;
-            } else {
-                [_delegate driver:self didCloseWithCode:PSWebSocketStatusCodeNoStatusReceived reason:nil];
-            }
+        default:
             break;
-        case PSWebSocketOpCodeContinuation:
-            return YES;
     }
     
     return YES;
@@ -824,46 +1097,77 @@ typedef NS_ENUM(NSInteger, PSWebSocketDriverState) {
 #pragma mark - permessage-deflate
 
 - (NSArray *)pmdExtensionsHeaderComponents {
-    if(_pmdEnabled) {
+    if(_pmdEnabled && _deflateOptions.enabled) {
         NSMutableArray *components = [NSMutableArray arrayWithObject:@"permessage-deflate"];
         
         // client mode
         if(_mode == PSWebSocketModeClient) {
             // say we'll take whatever window bits the server gives us
             [components addObject:@"client_max_window_bits"];
+            
+            // ask the server for a smaller window than the default
+            if(_deflateOptions.windowBits < 15) {
+                [components addObject:[NSString stringWithFormat:@"server_max_window_bits=%@", @(_deflateOptions.windowBits)]];
+            }
+            
+            // tell the server we won't keep context between messages
+            if(_deflateOptions.noContextTakeover) {
+                [components addObject:@"client_no_context_takeover"];
+            }
         }
         // server mode
         else if(_mode == PSWebSocketModeServer) {
-            // set the window bits the client must use
-            [components addObject:[NSString stringWithFormat:@"client_max_window_bits=%@", @(-_pmdClientWindowBits)]];
+            // set the window bits the client must use, only allowed if it offered them
+            if(_pmdClientWindowBitsOffered) {
+                [components addObject:[NSString stringWithFormat:@"client_max_window_bits=%@", @(-_pmdClientWindowBits)]];
+            }
             
             // set the window bits the server will use
             [components addObject:[NSString stringWithFormat:@"server_max_window_bits=%@", @(-_pmdServerWindowBits)]];
+            
+            // tell the client we won't keep context between messages
+            if(_pmdServerNoContextTakeover) {
+                [components addObject:@"server_no_context_takeover"];
+            }
+            
+            // acknowledge the client won't keep context between messages
+            if(_pmdClientNoContextTakeover) {
+                [components addObject:@"client_no_context_takeover"];
+            }
         }
         return components;
     }
     return @[];
 }
 - (BOOL)pmdConfigureWithExtensionsHeaderComponents:(NSArray *)components {
+    NSInteger windowBits = -(NSInteger)_deflateOptions.windowBits;
+    
     _pmdEnabled = NO;
-    _pmdClientWindowBits = -11;
+    _pmdClientWindowBits = -15;
     _pmdClientNoContextTakeover = NO;
-    _pmdServerWindowBits = -11;
+    _pmdServerWindowBits = -15;
     _pmdServerNoContextTakeover = NO;
+    _pmdClientWindowBitsOffered = NO;
     
+    NSCharacterSet *whitespace = [NSCharacterSet whitespaceCharacterSet];
     for(NSString *component in components) {
         // split to key & value
         NSArray *subcomponents = [component componentsSeparatedByString:@"="];
+        NSString *key = [subcomponents[0] stringByTrimmingCharactersInSet:whitespace];
+        NSString *value = (subcomponents.count > 1) ? [subcomponents[1] stringByTrimmingCharactersInSet:whitespace] : nil;
         
-        if([component isEqualToString:@"permessage-deflate"]) {
+        if([key isEqualToString:@"permessage-deflate"]) {
             _pmdEnabled = YES;
-        } else if([component isEqualToString:@"client_max_window_bits"] && subcomponents.count > 1) {
-            _pmdClientWindowBits = -[subcomponents[0] integerValue];
-        } else if([component isEqualToString:@"server_max_window_bits"] && subcomponents.count > 1) {
-            _pmdServerWindowBits = -[subcomponents[0] integerValue];
-        } else if([component isEqualToString:@"client_no_context_takeover"] && _mode == PSWebSocketModeClient) {
+        } else if([key isEqualToString:@"client_max_window_bits"]) {
+            _pmdClientWindowBitsOffered = YES;
+            if(value) {
+                _pmdClientWindowBits = -[value integerValue];
+            }
+        } else if([key isEqualToString:@"server_max_window_bits"] && value) {
+            _pmdServerWindowBits = -[value integerValue];
+        } else if([key isEqualToString:@"client_no_context_takeover"]) {
             _pmdClientNoContextTakeover = YES;
-        } else if([component isEqualToString:@"server_no_context_takeover"] && _mode == PSWebSocketModeClient) {
+        } else if([key isEqualToString:@"server_no_context_takeover"]) {
             _pmdServerNoContextTakeover = YES;
         }
     }
@@ -874,15 +1178,48 @@ typedef NS_ENUM(NSInteger, PSWebSocketDriverState) {
     if(_pmdServerWindowBits > -8 || _pmdServerWindowBits < -15) {
         return NO;
     }
+    if(_pmdEnabled && !_deflateOptions.enabled) {
+        // a server must not accept an extension we never offered
+        if(_mode == PSWebSocketModeClient) {
+            return NO;
+        }
+        _pmdEnabled = NO;
+    }
+    if(!_pmdEnabled) {
+        return YES;
+    }
     
+    // never use a larger window than configured for the direction we compress, the
+    // server also limits the client to it when the client lets it
+    NSInteger deflateWindowBits;
     if(_mode == PSWebSocketModeClient) {
-        _inflater = [[PSWebSocketInflater alloc] initWithWindowBits:_pmdClientWindowBits];
-        _deflater = [[PSWebSocketDeflater alloc] initWithWindowBits:_pmdServerWindowBits memoryLevel:8];
+        _pmdClientWindowBits = MAX(_pmdClientWindowBits, windowBits);
+        _pmdClientNoContextTakeover = (_pmdClientNoContextTakeover || _deflateOptions.noContextTakeover);
+        deflateWindowBits = _pmdClientWindowBits;
     } else {
-        _inflater = [[PSWebSocketInflater alloc] initWithWindowBits:_pmdServerWindowBits];
-        _deflater = [[PSWebSocketDeflater alloc] initWithWindowBits:_pmdClientWindowBits memoryLevel:8];
+        _pmdServerWindowBits = MAX(_pmdServerWindowBits, windowBits);
+        _pmdServerNoContextTakeover = (_pmdServerNoContextTakeover || _deflateOptions.noContextTakeover);
+        if(_pmdClientWindowBitsOffered) {
+            _pmdClientWindowBits = MAX(_pmdClientWindowBits, windowBits);
+        }
+        deflateWindowBits = _pmdServerWindowBits;
     }
     
+    // zlib cannot produce raw deflate with a 256 byte window
+    if(deflateWindowBits > -9) {
+        if(_mode == PSWebSocketModeClient) {
+            return NO;
+        }
+        _pmdEnabled = NO;
+        return YES;
+    }
+    
+    _deflater = [[PSWebSocketDeflater alloc] initWithWindowBits:deflateWindowBits
+                                                    memoryLevel:_deflateOptions.memoryLevel
+                                               compressionLevel:_deflateOptions.compressionLevel
+                                                       strategy:_deflateOptions.strategy];
+    _inflater = [[PSWebSocketInflater alloc] initWithWindowBits:(_mode == PSWebSocketModeClient) ? _pmdServerWindowBits : _pmdClientWindowBits];
+    
     return YES;
 }
 
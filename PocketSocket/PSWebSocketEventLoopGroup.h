@@ -0,0 +1,84 @@
+//  Copyright 2014 Zwopple Limited
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+typedef NS_ENUM(NSInteger, PSWebSocketEventLoopPlacement) {
+    PSWebSocketEventLoopPlacementRoundRobin = 0,
+    PSWebSocketEventLoopPlacementLeastLoaded
+};
+
+/**
+ *  A pool of network threads that websockets and servers schedule their streams on.
+ *  Each connection is placed on one thread when it opens and stays there until it
+ *  closes. Clients and servers may share a group.
+ */
+@interface PSWebSocketEventLoopGroup : NSObject
+
+#pragma mark - Class Methods
+
+/**
+ *  The group every websocket uses unless told otherwise, a single shared network thread
+ */
++ (instancetype)defaultGroup;
+
+#pragma mark - Properties
+
+@property (nonatomic, assign, readonly) NSUInteger threadCount;
+
+/**
+ *  Run loop of each thread in the group
+ */
+@property (nonatomic, strong, readonly) NSArray *runLoops;
+
+/**
+ *  How connections are spread over the threads. Defaults to
+ *  PSWebSocketEventLoopPlacementLeastLoaded.
+ */
+@property (atomic, assign) PSWebSocketEventLoopPlacement placement;
+
+/**
+ *  Number of connections currently placed on the group's threads
+ */
+@property (atomic, assign, readonly) NSUInteger connectionCount;
+
+#pragma mark - Initialization
+
+/**
+ *  Initialize a group with its own threads
+ *
+ *  @param threadCount number of network threads to start, usually the number of cores
+ */
+- (instancetype)initWithThreadCount:(NSUInteger)threadCount;
+
+#pragma mark - Actions
+
+/**
+ *  Place a connection on one of the group's threads. Every call must be balanced by
+ *  releaseRunLoop: once the connection's streams are unscheduled.
+ *
+ *  @return the run loop of the chosen thread
+ */
+- (NSRunLoop *)acquireRunLoop;
+- (void)releaseRunLoop:(NSRunLoop *)runLoop;
+
+/**
+ *  Count a connection placed on a particular thread of the group, such as the one it
+ *  was accepted on. Balanced by releaseRunLoop: like acquireRunLoop.
+ *
+ *  @param runLoop one of runLoops
+ */
+- (void)acquireRunLoop:(NSRunLoop *)runLoop;
+
+@end
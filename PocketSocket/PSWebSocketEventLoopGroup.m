@@ -0,0 +1,124 @@
+//  Copyright 2014 Zwopple Limited
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#import "PSWebSocketEventLoopGroup.h"
+#import "PSWebSocketNetworkThread.h"
+
+@interface PSWebSocketEventLoopGroup() {
+    NSArray *_threads;
+    NSUInteger *_loads;
+    NSUInteger _nextIndex;
+}
+
+@property (atomic, assign, readwrite) NSUInteger connectionCount;
+
+@end
+@implementation PSWebSocketEventLoopGroup
+
+#pragma mark - Class Methods
+
++ (instancetype)defaultGroup {
+    static id defaultGroup = nil;
+    static dispatch_once_t defaultGroupOnce = 0;
+    dispatch_once(&defaultGroupOnce, ^{
+        defaultGroup = [[self alloc] initWithThreads:@[[PSWebSocketNetworkThread sharedNetworkThread]]];
+    });
+    return defaultGroup;
+}
+
+#pragma mark - Properties
+
+- (NSUInteger)threadCount {
+    return _threads.count;
+}
+- (NSArray *)runLoops {
+    return [_threads valueForKey:@"runLoop"];
+}
+
+#pragma mark - Initialization
+
+- (instancetype)initWithThreadCount:(NSUInteger)threadCount {
+    NSParameterAssert(threadCount > 0);
+    NSMutableArray *threads = [NSMutableArray arrayWithCapacity:threadCount];
+    for(NSUInteger i = 0; i < threadCount; ++i) {
+        [threads addObject:[[PSWebSocketNetworkThread alloc] init]];
+    }
+    return [self initWithThreads:threads];
+}
+- (instancetype)initWithThreads:(NSArray *)threads {
+    if((self = [super init])) {
+        _threads = [threads copy];
+        _loads = calloc(_threads.count, sizeof(NSUInteger));
+        _nextIndex = 0;
+        _placement = PSWebSocketEventLoopPlacementLeastLoaded;
+        _connectionCount = 0;
+    }
+    return self;
+}
+
+#pragma mark - Actions
+
+- (NSRunLoop *)acquireRunLoop {
+    NSUInteger index = 0;
+    @synchronized(self) {
+        if(self.placement == PSWebSocketEventLoopPlacementRoundRobin) {
+            index = _nextIndex;
+            _nextIndex = (_nextIndex + 1) % _threads.count;
+        } else {
+            for(NSUInteger i = 1; i < _threads.count; ++i) {
+                if(_loads[i] < _loads[index]) {
+                    index = i;
+                }
+            }
+        }
+        ++_loads[index];
+        self.connectionCount += 1;
+    }
+    return [_threads[index] runLoop];
+}
+- (void)acquireRunLoop:(NSRunLoop *)runLoop {
+    NSParameterAssert(runLoop);
+    @synchronized(self) {
+        for(NSUInteger i = 0; i < _threads.count; ++i) {
+            if([_threads[i] runLoop] == runLoop) {
+                ++_loads[i];
+                self.connectionCount += 1;
+                return;
+            }
+        }
+    }
+    NSAssert(NO, @"Run loop does not belong to this group");
+}
+- (void)releaseRunLoop:(NSRunLoop *)runLoop {
+    NSParameterAssert(runLoop);
+    @synchronized(self) {
+        for(NSUInteger i = 0; i < _threads.count; ++i) {
+            if([_threads[i] runLoop] == runLoop) {
+                NSAssert(_loads[i] > 0, @"Run loop released more often than it was acquired");
+                --_loads[i];
+                self.connectionCount -= 1;
+                return;
+            }
+        }
+    }
+    NSAssert(NO, @"Run loop does not belong to this group");
+}
+
+#pragma mark - Dealloc
+
+- (void)dealloc {
+    free(_loads);
+}
+
+@end
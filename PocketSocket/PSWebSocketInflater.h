@@ -16,6 +16,11 @@
 
 @interface PSWebSocketInflater : NSObject
 
+#pragma mark - Properties
+
+// bytes the inflater may still write before failing with 1009, NSUIntegerMax for no limit
+@property (nonatomic, assign) NSUInteger outputLimit;
+
 #pragma mark - Initialization
 
 - (instancetype)initWithWindowBits:(NSInteger)windowBits;
@@ -26,5 +31,6 @@
 - (BOOL)appendBytes:(const void *)bytes length:(NSUInteger)length error:(NSError *__autoreleasing *)outError;
 - (BOOL)end:(NSError *__autoreleasing *)outError;
 - (void)reset;
+- (void)purge;
 
 @end
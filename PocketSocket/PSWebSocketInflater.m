@@ -16,9 +16,11 @@
 #import "PSWebSocketInternal.h"
 #import <zlib.h>
 
+// smallest amount the output buffer is grown by
+static const NSUInteger PSWebSocketInflaterMinGrowLength = 4096;
+
 @interface PSWebSocketInflater() {
     NSInteger _windowBits;
-    uint8_t _chunkBuffer[16384];
     z_stream _stream;
     BOOL _ready;
 
@@ -32,7 +34,7 @@
 - (instancetype)initWithWindowBits:(NSInteger)windowBits {
     if((self = [super init])) {
         _windowBits = windowBits;
-        [self reset];
+        _outputLimit = NSUIntegerMax;
     }
     return self;
 }
@@ -54,27 +56,49 @@
     _stream.avail_in = (uInt)length;
     _stream.next_in = (Bytef *)bytes;
     
+    // expect text like ratios to begin with and double from there, never growing
+    // the output past the point where the limit would be crossed
+    NSUInteger growLength = MAX(length * 4, PSWebSocketInflaterMinGrowLength);
+    NSUInteger writtenLength = _buffer.length;
+    NSUInteger producedLength = 0;
+    
     // inflate loop
     int ret;
     do {
+        // grow the destination and let zlib write straight into it
+        NSUInteger capacityLength = MIN(growLength, MIN(_outputLimit - producedLength, (NSUInteger)UINT_MAX - 1) + 1);
+        _buffer.length = writtenLength + capacityLength;
+        growLength *= 2;
+        
         // set output properties
-        _stream.avail_out = (uInt)sizeof(_chunkBuffer);
-        _stream.next_out = (Bytef *)_chunkBuffer;
+        _stream.avail_out = (uInt)capacityLength;
+        _stream.next_out = (Bytef *)_buffer.mutableBytes + writtenLength;
         
         // inflate and check status
         ret = inflate(&_stream, Z_SYNC_FLUSH);
         if(ret == Z_NEED_DICT || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR) {
+            _buffer.length = writtenLength;
             PSWebSocketSetOutError(outError, PSWebSocketStatusCodeProtocolError, @"Failed to inflate bytes");
             return NO;
         }
         
         // determine number of bytes inflated
-        uInt gotBack = sizeof(_chunkBuffer) - _stream.avail_out;
-        if(gotBack > 0) {
-            [_buffer appendBytes:_chunkBuffer length:gotBack];
+        NSUInteger gotBack = capacityLength - _stream.avail_out;
+        writtenLength += gotBack;
+        producedLength += gotBack;
+        _buffer.length = writtenLength;
+        
+        // stop as soon as the limit is crossed rather than inflating the rest
+        if(producedLength > _outputLimit) {
+            PSWebSocketSetOutError(outError, PSWebSocketStatusCodeMessageTooBig, @"Inflated message too large");
+            return NO;
         }
     } while(_stream.avail_out == 0);
     
+    if(_outputLimit != NSUIntegerMax) {
+        _outputLimit -= producedLength;
+    }
+    
     return YES;
 }
 - (BOOL)end:(NSError *__autoreleasing *)outError {
@@ -82,11 +106,16 @@
     return [self appendBytes:finish length:sizeof(finish) error:outError];
 }
 - (void)reset {
+    _buffer = nil;
+    if(_ready && inflateReset(&_stream) != Z_OK) {
+        [self purge];
+    }
+}
+- (void)purge {
+    _buffer = nil;
     if(_ready) {
-        _buffer = nil;
         inflateEnd(&_stream);
         bzero(&_stream, sizeof(_stream));
-        bzero(_chunkBuffer, sizeof(_chunkBuffer));
         _ready = NO;
     }
 }
@@ -107,7 +136,7 @@
 #pragma mark - Dealloc
 
 - (void)dealloc {
-    [self reset];
+    [self purge];
 }
 
 @end
@@ -35,6 +35,9 @@ static const uint8_t PSWebSocketRsv3Mask = 0x10;
 static const uint8_t PSWebSocketMaskMask = 0x80;
 static const uint8_t PSWebSocketPayloadLenMask = 0x7F;
 
+// default time a websocket goes without traffic before its zlib state is freed
+static const NSTimeInterval PSWebSocketDefaultCompressionIdleInterval = 30.0;
+
 #define PSWebSocketSetOutError(e, c, d) if(e){ *e = [NSError errorWithDomain:PSWebSocketErrorDomain code:c userInfo:@{NSLocalizedDescriptionKey: d}]; }
 
 static inline void _PSWebSocketLog(id self, NSString *format, ...) {
@@ -0,0 +1,35 @@
+//  Copyright 2014 Zwopple Limited
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+/**
+ *  Mask or unmask bytes in place with a 4 byte websocket mask key.
+ *
+ *  @param bytes      bytes to mask
+ *  @param length     number of bytes to mask
+ *  @param maskKey    4 byte mask key from the frame header
+ *  @param maskOffset offset into the mask key the first byte lines up with
+ *
+ *  @return the mask offset to continue with for the next chunk of the same frame
+ */
+uint32_t PSWebSocketMaskBytes(uint8_t *bytes, NSUInteger length, const uint8_t maskKey[4], uint32_t maskOffset);
+
+/**
+ *  Mask or unmask bytes from src into dst with a 4 byte websocket mask key.
+ *  dst and src may be the same pointer but must not otherwise overlap.
+ *
+ *  @return the mask offset to continue with for the next chunk of the same frame
+ */
+uint32_t PSWebSocketMaskBytesCopy(uint8_t *dst, const uint8_t *src, NSUInteger length, const uint8_t maskKey[4], uint32_t maskOffset);
@@ -0,0 +1,216 @@
+//  Copyright 2014 Zwopple Limited
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#import "PSWebSocketMask.h"
+#if defined(__x86_64__) || defined(__i386__)
+#import <immintrin.h>
+#import <sys/sysctl.h>
+#define PS_MASK_X86 1
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#import <arm_neon.h>
+#define PS_MASK_NEON 1
+#endif
+
+// All kernels take the mask already rotated so that its first byte lines up
+// with src[0]. The mask is kept in memory order so xor'ing it against bytes
+// loaded with memcpy is endian independent.
+typedef void (*PSWebSocketMaskKernel)(uint8_t *dst, const uint8_t *src, size_t length, uint32_t mask);
+
+static inline uint32_t PSWebSocketMaskRotate(uint32_t mask, size_t count) {
+    uint8_t key[4], rotated[4];
+    memcpy(key, &mask, sizeof(key));
+    for(size_t i = 0; i < sizeof(rotated); ++i) {
+        rotated[i] = key[(i + count) & 3];
+    }
+    memcpy(&mask, rotated, sizeof(mask));
+    return mask;
+}
+
+#pragma mark - Word
+
+static void PSWebSocketMaskKernelWord(uint8_t *dst, const uint8_t *src, size_t length, uint32_t mask) {
+    uint8_t key[4];
+    memcpy(key, &mask, sizeof(key));
+
+    // unaligned head
+    size_t i = 0;
+    while(i < length && ((uintptr_t)(dst + i) & (sizeof(uint64_t) - 1))) {
+        dst[i] = src[i] ^ key[i & 3];
+        ++i;
+    }
+
+    // aligned body
+    if(length - i >= sizeof(uint64_t)) {
+        uint32_t rotated = PSWebSocketMaskRotate(mask, i);
+        uint64_t wide;
+        memcpy(&wide, &rotated, sizeof(rotated));
+        memcpy((uint8_t *)&wide + sizeof(rotated), &rotated, sizeof(rotated));
+        for(; length - i >= sizeof(uint64_t); i += sizeof(uint64_t)) {
+            uint64_t word;
+            memcpy(&word, src + i, sizeof(word));
+            word ^= wide;
+            memcpy(dst + i, &word, sizeof(word));
+        }
+    }
+
+    // tail
+    for(; i < length; ++i) {
+        dst[i] = src[i] ^ key[i & 3];
+    }
+}
+
+#pragma mark - SSE2 / AVX2
+
+#if PS_MASK_X86
+
+static void PSWebSocketMaskKernelSSE2(uint8_t *dst, const uint8_t *src, size_t length, uint32_t mask) {
+    size_t i = 0;
+    if(length >= 64) {
+        // line the stores up on a 16 byte boundary
+        size_t head = (16 - ((uintptr_t)dst & 15)) & 15;
+        PSWebSocketMaskKernelWord(dst, src, head, mask);
+        i = head;
+
+        __m128i wide = _mm_set1_epi32((int)PSWebSocketMaskRotate(mask, i));
+        for(; length - i >= 64; i += 64) {
+            __m128i a = _mm_loadu_si128((const __m128i *)(src + i));
+            __m128i b = _mm_loadu_si128((const __m128i *)(src + i + 16));
+            __m128i c = _mm_loadu_si128((const __m128i *)(src + i + 32));
+            __m128i d = _mm_loadu_si128((const __m128i *)(src + i + 48));
+            _mm_store_si128((__m128i *)(dst + i), _mm_xor_si128(a, wide));
+            _mm_store_si128((__m128i *)(dst + i + 16), _mm_xor_si128(b, wide));
+            _mm_store_si128((__m128i *)(dst + i + 32), _mm_xor_si128(c, wide));
+            _mm_store_si128((__m128i *)(dst + i + 48), _mm_xor_si128(d, wide));
+        }
+        for(; length - i >= 16; i += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i *)(src + i));
+            _mm_store_si128((__m128i *)(dst + i), _mm_xor_si128(a, wide));
+        }
+    }
+    PSWebSocketMaskKernelWord(dst + i, src + i, length - i, PSWebSocketMaskRotate(mask, i));
+}
+
+__attribute__((target("avx2")))
+static void PSWebSocketMaskKernelAVX2(uint8_t *dst, const uint8_t *src, size_t length, uint32_t mask) {
+    size_t i = 0;
+    if(length >= 128) {
+        // line the stores up on a 32 byte boundary
+        size_t head = (32 - ((uintptr_t)dst & 31)) & 31;
+        PSWebSocketMaskKernelWord(dst, src, head, mask);
+        i = head;
+
+        __m256i wide = _mm256_set1_epi32((int)PSWebSocketMaskRotate(mask, i));
+        for(; length - i >= 128; i += 128) {
+            __m256i a = _mm256_loadu_si256((const __m256i *)(src + i));
+            __m256i b = _mm256_loadu_si256((const __m256i *)(src + i + 32));
+            __m256i c = _mm256_loadu_si256((const __m256i *)(src + i + 64));
+            __m256i d = _mm256_loadu_si256((const __m256i *)(src + i + 96));
+            _mm256_store_si256((__m256i *)(dst + i), _mm256_xor_si256(a, wide));
+            _mm256_store_si256((__m256i *)(dst + i + 32), _mm256_xor_si256(b, wide));
+            _mm256_store_si256((__m256i *)(dst + i + 64), _mm256_xor_si256(c, wide));
+            _mm256_store_si256((__m256i *)(dst + i + 96), _mm256_xor_si256(d, wide));
+        }
+        for(; length - i >= 32; i += 32) {
+            __m256i a = _mm256_loadu_si256((const __m256i *)(src + i));
+            _mm256_store_si256((__m256i *)(dst + i), _mm256_xor_si256(a, wide));
+        }
+        _mm256_zeroupper();
+    }
+    PSWebSocketMaskKernelSSE2(dst + i, src + i, length - i, PSWebSocketMaskRotate(mask, i));
+}
+
+static BOOL PSWebSocketMaskHasAVX2(void) {
+    int value = 0;
+    size_t size = sizeof(value);
+    if(sysctlbyname("hw.optional.avx2_0", &value, &size, NULL, 0) != 0) {
+        return NO;
+    }
+    return value != 0;
+}
+
+#endif
+
+#pragma mark - NEON
+
+#if PS_MASK_NEON
+
+static void PSWebSocketMaskKernelNEON(uint8_t *dst, const uint8_t *src, size_t length, uint32_t mask) {
+    size_t i = 0;
+    if(length >= 64) {
+        // line the stores up on a 16 byte boundary
+        size_t head = (16 - ((uintptr_t)dst & 15)) & 15;
+        PSWebSocketMaskKernelWord(dst, src, head, mask);
+        i = head;
+
+        uint8x16_t wide = vreinterpretq_u8_u32(vdupq_n_u32(PSWebSocketMaskRotate(mask, i)));
+        for(; length - i >= 64; i += 64) {
+            uint8x16_t a = vld1q_u8(src + i);
+            uint8x16_t b = vld1q_u8(src + i + 16);
+            uint8x16_t c = vld1q_u8(src + i + 32);
+            uint8x16_t d = vld1q_u8(src + i + 48);
+            vst1q_u8(dst + i, veorq_u8(a, wide));
+            vst1q_u8(dst + i + 16, veorq_u8(b, wide));
+            vst1q_u8(dst + i + 32, veorq_u8(c, wide));
+            vst1q_u8(dst + i + 48, veorq_u8(d, wide));
+        }
+        for(; length - i >= 16; i += 16) {
+            vst1q_u8(dst + i, veorq_u8(vld1q_u8(src + i), wide));
+        }
+    }
+    PSWebSocketMaskKernelWord(dst + i, src + i, length - i, PSWebSocketMaskRotate(mask, i));
+}
+
+#endif
+
+#pragma mark - Dispatch
+
+static PSWebSocketMaskKernel PSWebSocketMaskSelectedKernel(void) {
+    static PSWebSocketMaskKernel kernel = NULL;
+    static dispatch_once_t kernelOnce = 0;
+    dispatch_once(&kernelOnce, ^{
+        kernel = PSWebSocketMaskKernelWord;
+#if PS_MASK_X86
+#if defined(__x86_64__) || defined(__SSE2__)
+        kernel = PSWebSocketMaskKernelSSE2;
+#endif
+        if(PSWebSocketMaskHasAVX2()) {
+            kernel = PSWebSocketMaskKernelAVX2;
+        }
+#elif PS_MASK_NEON
+        kernel = PSWebSocketMaskKernelNEON;
+#endif
+    });
+    return kernel;
+}
+
+uint32_t PSWebSocketMaskBytes(uint8_t *bytes, NSUInteger length, const uint8_t maskKey[4], uint32_t maskOffset) {
+    return PSWebSocketMaskBytesCopy(bytes, bytes, length, maskKey, maskOffset);
+}
+
+uint32_t PSWebSocketMaskBytesCopy(uint8_t *dst, const uint8_t *src, NSUInteger length, const uint8_t maskKey[4], uint32_t maskOffset) {
+    if(length == 0) {
+        return maskOffset & 3;
+    }
+    uint32_t mask;
+    memcpy(&mask, maskKey, sizeof(mask));
+    mask = PSWebSocketMaskRotate(mask, maskOffset);
+
+    // tiny payloads (control frames, short text) are cheaper without the indirect call
+    if(length < 16) {
+        PSWebSocketMaskKernelWord(dst, src, length, mask);
+    } else {
+        PSWebSocketMaskSelectedKernel()(dst, src, length, mask);
+    }
+    return (uint32_t)((maskOffset + length) & 3);
+}
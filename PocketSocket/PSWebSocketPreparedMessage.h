@@ -0,0 +1,71 @@
+//  Copyright 2014 Zwopple Limited
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+@class PSWebSocketDeflateOptions;
+
+/**
+ *  A message encoded once to be sent to many websockets with send:. Each websocket
+ *  that negotiated permessage-deflate is handed the same deflated payload, compressed
+ *  once per window size, and every other websocket the same uncompressed payload.
+ *  Immutable and safe to share between websockets and threads.
+ */
+@interface PSWebSocketPreparedMessage : NSObject
+
+#pragma mark - Class Methods
+
+/**
+ *  Prepare a message compressed with the balanced deflate options
+ *
+ *  @param message an instance of NSData or NSString
+ */
++ (instancetype)preparedMessageWithMessage:(id)message;
+
+/**
+ *  Prepare a message
+ *
+ *  @param message        an instance of NSData or NSString
+ *  @param deflateOptions level, strategy and memory level to deflate with, window bits
+ *                        come from each websocket's negotiation. nil or disabled options
+ *                        send the message uncompressed everywhere.
+ */
++ (instancetype)preparedMessageWithMessage:(id)message deflateOptions:(PSWebSocketDeflateOptions *)deflateOptions;
+
+#pragma mark - Properties
+
+@property (nonatomic, assign, readonly, getter=isBinary) BOOL binary;
+
+/**
+ *  Uncompressed payload, UTF-8 for text messages
+ */
+@property (nonatomic, strong, readonly) NSData *data;
+
+#pragma mark - Initialization
+
+- (instancetype)initWithMessage:(id)message deflateOptions:(PSWebSocketDeflateOptions *)deflateOptions;
+
+#pragma mark - Actions
+
+/**
+ *  Deflated payload without the sync flush trailer for a window of the given size,
+ *  built on first use and shared afterwards
+ *
+ *  @param windowBits 9 to 15
+ *
+ *  @return the payload, or nil when the message is not worth compressing
+ */
+- (NSData *)deflatedDataWithWindowBits:(NSUInteger)windowBits;
+
+@end
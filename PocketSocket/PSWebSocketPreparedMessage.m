@@ -0,0 +1,96 @@
+//  Copyright 2014 Zwopple Limited
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#import "PSWebSocketPreparedMessage.h"
+#import "PSWebSocketDeflateOptions.h"
+#import "PSWebSocketDeflater.h"
+
+@interface PSWebSocketPreparedMessage() {
+    PSWebSocketDeflateOptions *_deflateOptions;
+    NSMutableDictionary *_deflatedDataByWindowBits;
+}
+@end
+@implementation PSWebSocketPreparedMessage
+
+#pragma mark - Class Methods
+
++ (instancetype)preparedMessageWithMessage:(id)message {
+    return [[self alloc] initWithMessage:message deflateOptions:[PSWebSocketDeflateOptions balancedOptions]];
+}
++ (instancetype)preparedMessageWithMessage:(id)message deflateOptions:(PSWebSocketDeflateOptions *)deflateOptions {
+    return [[self alloc] initWithMessage:message deflateOptions:deflateOptions];
+}
+
+#pragma mark - Initialization
+
+- (instancetype)initWithMessage:(id)message deflateOptions:(PSWebSocketDeflateOptions *)deflateOptions {
+    NSParameterAssert(message);
+    if((self = [super init])) {
+        if([message isKindOfClass:[NSString class]]) {
+            _binary = NO;
+            _data = [message dataUsingEncoding:NSUTF8StringEncoding];
+        } else if([message isKindOfClass:[NSData class]]) {
+            _binary = YES;
+            _data = [message copy];
+        } else {
+            [NSException raise:@"Invalid Message" format:@"Messages must be instances of NSString or NSData"];
+            return nil;
+        }
+        _deflateOptions = (deflateOptions.enabled) ? [deflateOptions copy] : nil;
+        _deflatedDataByWindowBits = [NSMutableDictionary dictionary];
+    }
+    return self;
+}
+
+#pragma mark - Actions
+
+- (NSData *)deflatedDataWithWindowBits:(NSUInteger)windowBits {
+    if(!_deflateOptions || _data.length == 0) {
+        return nil;
+    }
+    windowBits = MIN(MAX(windowBits, 9), 15);
+    
+    @synchronized(self) {
+        id deflated = _deflatedDataByWindowBits[@(windowBits)];
+        if(!deflated) {
+            deflated = [self deflateWithWindowBits:windowBits];
+            
+            // remember payloads that didn't shrink so they go out uncompressed
+            if(!deflated || [deflated length] >= _data.length) {
+                deflated = [NSNull null];
+            }
+            _deflatedDataByWindowBits[@(windowBits)] = deflated;
+        }
+        return (deflated != [NSNull null]) ? deflated : nil;
+    }
+}
+
+#pragma mark - Private
+
+- (NSData *)deflateWithWindowBits:(NSUInteger)windowBits {
+    PSWebSocketDeflater *deflater = [[PSWebSocketDeflater alloc] initWithWindowBits:-(NSInteger)windowBits
+                                                                        memoryLevel:_deflateOptions.memoryLevel
+                                                                   compressionLevel:_deflateOptions.compressionLevel
+                                                                           strategy:_deflateOptions.strategy];
+    NSMutableData *deflated = [NSMutableData data];
+    if(![deflater begin:deflated error:nil] ||
+       ![deflater appendBytes:_data.bytes length:_data.length flush:YES error:nil] ||
+       ![deflater end:nil]) {
+        return nil;
+    }
+    [deflater purge];
+    return [deflated copy];
+}
+
+@end
@@ -30,6 +30,29 @@
 - (void)server:(PSWebSocketServer *)server webSocket:(PSWebSocket *)webSocket didFailWithError:(NSError *)error;
 - (void)server:(PSWebSocketServer *)server webSocket:(PSWebSocket *)webSocket didCloseWithCode:(NSInteger)code reason:(NSString *)reason wasClean:(BOOL)wasClean;
 
+@optional
+
+/**
+ *  Called instead of server:webSocket:didReceiveMessage: for text messages when implemented.
+ *  See webSocket:didReceiveUTF8Message: on PSWebSocketDelegate.
+ */
+- (void)server:(PSWebSocketServer *)server webSocket:(PSWebSocket *)webSocket didReceiveUTF8Message:(NSData *)message;
+
+/**
+ *  Streaming receive callbacks, see webSocket:didReceiveMessageChunk: on PSWebSocketDelegate.
+ *  Messages are only delivered in chunks when server:webSocket:didReceiveMessageChunk: is
+ *  implemented before websockets are accepted.
+ */
+- (void)server:(PSWebSocketServer *)server webSocket:(PSWebSocket *)webSocket didBeginMessage:(BOOL)binary;
+- (void)server:(PSWebSocketServer *)server webSocket:(PSWebSocket *)webSocket didReceiveMessageChunk:(NSData *)chunk;
+- (void)server:(PSWebSocketServer *)server webSocketDidEndMessage:(PSWebSocket *)webSocket;
+
+/**
+ *  Outbound backpressure callbacks, see webSocketDidReachHighWatermark: on PSWebSocketDelegate.
+ */
+- (void)server:(PSWebSocketServer *)server webSocketDidReachHighWatermark:(PSWebSocket *)webSocket;
+- (void)server:(PSWebSocketServer *)server webSocketDidDrainToLowWatermark:(PSWebSocket *)webSocket;
+
 @end
 
 @interface PSWebSocketServer : NSObject
@@ -39,6 +62,68 @@
 @property (nonatomic, weak) id <PSWebSocketServerDelegate> delegate;
 @property (nonatomic, strong) dispatch_queue_t delegateQueue;
 
+/**
+ *  Network threads the server listens and accepts on. Accepted websockets stay on the
+ *  thread their handshake ran on. Must be set before starting. Defaults to nil, a
+ *  thread of the server's own with websockets on PSWebSocket's default group.
+ */
+@property (nonatomic, strong) PSWebSocketEventLoopGroup *eventLoopGroup;
+
+/**
+ *  Once the handshake is done, hand the plain sockets of accepted websockets over
+ *  without their streams and watch them with dispatch sources delivering straight to
+ *  each websocket's queue. Handshakes still run on the network threads, and TLS
+ *  servers and client websockets always use streams. Must be set before starting.
+ *  Defaults to NO.
+ */
+@property (nonatomic, assign) BOOL usesDispatchSources;
+
+/**
+ *  Size limits applied to every accepted websocket, see the matching properties on
+ *  PSWebSocket. All default to 0, no limit.
+ */
+@property (nonatomic, assign) NSUInteger maxFrameLength;
+@property (nonatomic, assign) NSUInteger maxMessageLength;
+@property (nonatomic, assign) NSUInteger maxInflatedMessageLength;
+
+/**
+ *  permessage-deflate settings applied to every accepted websocket, see deflateOptions
+ *  on PSWebSocket. Defaults to nil, the websocket's own defaults.
+ */
+@property (nonatomic, copy) PSWebSocketDeflateOptions *deflateOptions;
+
+/**
+ *  Bytes of zlib state all accepted websockets may hold between them. Once it runs low
+ *  new websockets negotiate smaller windows and memory levels than deflateOptions, then
+ *  no context takeover so the compressor is only held while sending, and finally no
+ *  compression. Costs follow the parameters actually negotiated. Defaults to 0, no limit.
+ */
+@property (nonatomic, assign) NSUInteger compressionMemoryBudget;
+
+/**
+ *  Idle interval applied to every accepted websocket, see compressionIdleInterval on
+ *  PSWebSocket. Defaults to 30.
+ */
+@property (nonatomic, assign) NSTimeInterval compressionIdleInterval;
+
+/**
+ *  Estimated bytes of zlib state held by the open websockets
+ */
+@property (nonatomic, assign, readonly) NSUInteger compressionMemoryUsage;
+
+/**
+ *  Output watermarks applied to every accepted websocket, see the matching properties
+ *  on PSWebSocket
+ */
+@property (nonatomic, assign) NSUInteger highWatermark;
+@property (nonatomic, assign) NSUInteger lowWatermark;
+
+/**
+ *  Undelivered message limit applied to every accepted websocket, see
+ *  maxUndeliveredMessages on PSWebSocket
+ */
+@property (nonatomic, assign) NSUInteger maxUndeliveredMessages;
+
 #pragma mark - Initialization
 
 + (instancetype)serverWithHost:(NSString *)host port:(NSUInteger)port;
@@ -49,4 +134,43 @@
 - (void)start;
 - (void)stop;
 
+/**
+ *  Send the same message to several websockets, encoding and deflating it once with
+ *  deflateOptions rather than once per websocket
+ *
+ *  @param message    an instance of NSData, NSString or PSWebSocketPreparedMessage
+ *  @param webSockets websockets to send the message to
+ */
+- (void)send:(id)message toWebSockets:(id <NSFastEnumeration>)webSockets;
+
+/**
+ *  Send a message to every open websocket the server manages, encoded and deflated once
+ *
+ *  @param message an instance of NSData, NSString or PSWebSocketPreparedMessage
+ */
+- (void)broadcast:(id)message;
+
+/**
+ *  Send a message to every open websocket subscribed to a topic, encoded and deflated once
+ *
+ *  @param message an instance of NSData, NSString or PSWebSocketPreparedMessage
+ *  @param topic   topic to publish to
+ */
+- (void)publish:(id)message toTopic:(NSString *)topic;
+
+/**
+ *  Subscribe one of the server's websockets to a topic. Websockets are unsubscribed
+ *  from all their topics when they close.
+ *
+ *  @param webSocket websocket accepted by this server
+ *  @param topic     topic to subscribe to
+ */
+- (void)subscribeWebSocket:(PSWebSocket *)webSocket toTopic:(NSString *)topic;
+- (void)unsubscribeWebSocket:(PSWebSocket *)webSocket fromTopic:(NSString *)topic;
+
+/**
+ *  Number of websockets currently subscribed to a topic
+ */
+- (NSUInteger)subscriberCountForTopic:(NSString *)topic;
+
 @end
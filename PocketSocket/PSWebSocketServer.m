@@ -25,8 +25,24 @@
 #import <ifaddrs.h>
 #import <netdb.h>
 #import <arpa/inet.h>
+#import <unistd.h>
 #import <Security/SecureTransport.h>
 
+// largest handshake request accepted from a connection
+static const NSUInteger PSWebSocketServerMaxRequestLength = 16384;
+
+// fixed zlib state on top of the window and hash, rounded up from zlib's structs
+static const NSUInteger PSWebSocketServerDeflateOverhead = 6144;
+static const NSUInteger PSWebSocketServerInflateOverhead = 7168;
+
+// zlib's documented memory use for a deflate and an inflate stream
+static inline NSUInteger PSWebSocketServerDeflateMemoryCost(NSUInteger windowBits, NSUInteger memoryLevel) {
+    return PSWebSocketServerDeflateOverhead + (1 << (windowBits + 2)) + (1 << (memoryLevel + 9));
+}
+static inline NSUInteger PSWebSocketServerInflateMemoryCost(NSUInteger windowBits) {
+    return PSWebSocketServerInflateOverhead + (1 << windowBits);
+}
+
 typedef NS_ENUM(NSInteger, PSWebSocketServerConnectionReadyState) {
     PSWebSocketServerConnectionReadyStateConnecting = 0,
     PSWebSocketServerConnectionReadyStateOpen,
@@ -34,16 +50,34 @@ typedef NS_ENUM(NSInteger, PSWebSocketServerConnectionReadyState) {
     PSWebSocketServerConnectionReadyStateClosed
 };
 
-@interface PSWebSocketServerConnection : NSObject
+@interface PSWebSocket (PSWebSocketServer)
+
++ (instancetype)serverSocketWithRequest:(NSURLRequest *)request nativeSocket:(CFSocketNativeHandle)nativeSocket;
+- (void)adoptRunLoop:(NSRunLoop *)runLoop fromEventLoopGroup:(PSWebSocketEventLoopGroup *)eventLoopGroup;
+
+@end
+
+@class PSWebSocketServerConnection;
 
+@interface PSWebSocketServer (PSWebSocketServerConnection)
+
+- (void)connection:(PSWebSocketServerConnection *)connection stream:(NSStream *)stream handleEvent:(NSStreamEvent)event;
+
+@end
+
+@interface PSWebSocketServerConnection : NSObject <NSStreamDelegate>
+
+@property (nonatomic, weak) PSWebSocketServer *server;
 @property (nonatomic, strong, readonly) NSString *identifier;
 @property (nonatomic, assign) PSWebSocketServerConnectionReadyState readyState;
 @property (nonatomic, strong) NSInputStream *inputStream;
 @property (nonatomic, strong) NSOutputStream *outputStream;
+@property (nonatomic, assign) CFSocketNativeHandle nativeSocket;
 @property (nonatomic, assign) BOOL inputStreamOpenCompleted;
 @property (nonatomic, assign) BOOL outputStreamOpenCompleted;
 @property (nonatomic, strong) PSWebSocketBuffer *inputBuffer;
 @property (nonatomic, strong) PSWebSocketBuffer *outputBuffer;
+@property (nonatomic, strong) NSRunLoop *runLoop;
 
 @end
 @implementation PSWebSocketServerConnection
@@ -57,13 +91,28 @@ typedef NS_ENUM(NSInteger, PSWebSocketServerConnectionReadyState) {
     }
     return self;
 }
+- (void)stream:(NSStream *)stream handleEvent:(NSStreamEvent)event {
+    // events arrive on the connection's own thread and are handled right there
+    [_server connection:self stream:stream handleEvent:event];
+}
 
 @end
 
+@interface PSWebSocketServerListener : NSObject
+
+@property (nonatomic, weak) PSWebSocketServer *server;
+@property (nonatomic, assign) CFSocketRef socket;
+@property (nonatomic, assign) CFRunLoopSourceRef runLoopSource;
+@property (nonatomic, strong) NSRunLoop *runLoop;
+
+@end
+@implementation PSWebSocketServerListener
+@end
+
 
 void PSWebSocketServerAcceptCallback(CFSocketRef s, CFSocketCallBackType type, CFDataRef address, const void *data, void *info);
 
-@interface PSWebSocketServer() <NSStreamDelegate, PSWebSocketDelegate> {
+@interface PSWebSocketServer() <PSWebSocketDelegate> {
     PSWebSocketNetworkThread *_networkThread;
     dispatch_queue_t _workQueue;
     
@@ -71,16 +120,19 @@ void PSWebSocketServerAcceptCallback(CFSocketRef s, CFSocketCallBackType type, C
     BOOL _secure;
     
     NSData *_addrData;
-    CFSocketContext _socketContext;
     
     BOOL _running;
-    CFSocketRef _socket;
-    CFRunLoopSourceRef _socketRunLoopSource;
+    PSWebSocketServerListener *_listener;
     
     NSMutableSet *_connections;
-    NSMapTable *_connectionsByStreams;
     
     NSMutableSet *_webSockets;
+    NSMutableSet *_openWebSockets;
+    NSMutableDictionary *_webSocketsByTopic;
+    NSMapTable *_topicsByWebSocket;
+    
+    NSUInteger _compressionMemoryUsage;
+    NSMapTable *_compressionMemoryByWebSocket;
 }
 @end
 @implementation PSWebSocketServer
@@ -93,6 +145,21 @@ void PSWebSocketServerAcceptCallback(CFSocketRef s, CFSocketCallBackType type, C
     }
     return _networkThread.runLoop;
 }
+- (NSRunLoop *)acquireRunLoop {
+    return (_eventLoopGroup) ? [_eventLoopGroup acquireRunLoop] : [self runLoop];
+}
+- (void)releaseRunLoop:(NSRunLoop *)runLoop {
+    if(_eventLoopGroup) {
+        [_eventLoopGroup releaseRunLoop:runLoop];
+    }
+}
+- (NSUInteger)compressionMemoryUsage {
+    __block NSUInteger value = 0;
+    [self executeWorkAndWait:^{
+        value = _compressionMemoryUsage;
+    }];
+    return value;
+}
 
 #pragma mark - Initialization
 
@@ -105,7 +172,6 @@ void PSWebSocketServerAcceptCallback(CFSocketRef s, CFSocketCallBackType type, C
 - (instancetype)initWithHost:(NSString *)host port:(NSUInteger)port SSLCertificates:(NSArray *)SSLCertificates {
     NSParameterAssert(port);
     if((self = [super init])) {
-        _networkThread = [[PSWebSocketNetworkThread alloc] init];
         _workQueue = dispatch_queue_create(nil, nil);
         
         // copy SSL certificates
@@ -129,14 +195,19 @@ void PSWebSocketServerAcceptCallback(CFSocketRef s, CFSocketCallBackType type, C
         addr.sin_port = htons(port);
         _addrData = [NSData dataWithBytes:&addr length:sizeof(addr)];
         
-        // create socket context
-        _socketContext = (CFSocketContext){0, (__bridge void *)self, NULL, NULL, NULL};
         
         _connections = [NSMutableSet set];
-        _connectionsByStreams = [NSMapTable weakToWeakObjectsMapTable];
         
         _webSockets = [NSMutableSet set];
+        _openWebSockets = [NSMutableSet set];
+        _webSocketsByTopic = [NSMutableDictionary dictionary];
+        _topicsByWebSocket = [NSMapTable mapTableWithKeyOptions:NSPointerFunctionsStrongMemory | NSPointerFunctionsObjectPointerPersonality
+                                                   valueOptions:NSPointerFunctionsStrongMemory];
         
+        _compressionIdleInterval = PSWebSocketDefaultCompressionIdleInterval;
+        _compressionMemoryUsage = 0;
+        _compressionMemoryByWebSocket = [NSMapTable mapTableWithKeyOptions:NSPointerFunctionsStrongMemory | NSPointerFunctionsObjectPointerPersonality
+                                                              valueOptions:NSPointerFunctionsStrongMemory];
     }
     return self;
 }
@@ -153,6 +224,83 @@ void PSWebSocketServerAcceptCallback(CFSocketRef s, CFSocketCallBackType type, C
         [self disconnectGracefully:NO];
     }];
 }
+- (void)send:(id)message toWebSockets:(id <NSFastEnumeration>)webSockets {
+    NSParameterAssert(message);
+    PSWebSocketPreparedMessage *preparedMessage = [self preparedMessageWithMessage:message];
+    for(PSWebSocket *webSocket in webSockets) {
+        [webSocket send:preparedMessage];
+    }
+}
+- (void)broadcast:(id)message {
+    NSParameterAssert(message);
+    PSWebSocketPreparedMessage *preparedMessage = [self preparedMessageWithMessage:message];
+    [self executeWork:^{
+        // skip websockets still handshaking, closing ones drop it themselves. Each
+        // websocket's state belongs to its own queue so this is a hop per websocket,
+        // a burst of broadcasts shares it through the websocket's inbox.
+        for(PSWebSocket *webSocket in _openWebSockets) {
+            [webSocket send:preparedMessage];
+        }
+    }];
+}
+- (void)publish:(id)message toTopic:(NSString *)topic {
+    NSParameterAssert(message);
+    NSParameterAssert(topic);
+    PSWebSocketPreparedMessage *preparedMessage = [self preparedMessageWithMessage:message];
+    [self executeWork:^{
+        // a hop per subscriber, coalesced the same way as broadcasts
+        for(PSWebSocket *webSocket in _webSocketsByTopic[topic]) {
+            if([_openWebSockets containsObject:webSocket]) {
+                [webSocket send:preparedMessage];
+            }
+        }
+    }];
+}
+- (void)subscribeWebSocket:(PSWebSocket *)webSocket toTopic:(NSString *)topic {
+    NSParameterAssert(webSocket);
+    NSParameterAssert(topic);
+    topic = [topic copy];
+    [self executeWork:^{
+        // only websockets we still manage, anything else would never be unsubscribed
+        if(![_webSockets containsObject:webSocket]) {
+            return;
+        }
+        NSMutableSet *webSockets = _webSocketsByTopic[topic];
+        if(!webSockets) {
+            webSockets = [NSMutableSet set];
+            _webSocketsByTopic[topic] = webSockets;
+        }
+        [webSockets addObject:webSocket];
+        
+        NSMutableSet *topics = [_topicsByWebSocket objectForKey:webSocket];
+        if(!topics) {
+            topics = [NSMutableSet set];
+            [_topicsByWebSocket setObject:topics forKey:webSocket];
+        }
+        [topics addObject:topic];
+    }];
+}
+- (void)unsubscribeWebSocket:(PSWebSocket *)webSocket fromTopic:(NSString *)topic {
+    NSParameterAssert(webSocket);
+    NSParameterAssert(topic);
+    [self executeWork:^{
+        [self removeWebSocket:webSocket fromTopic:topic];
+        
+        NSMutableSet *topics = [_topicsByWebSocket objectForKey:webSocket];
+        [topics removeObject:topic];
+        if(topics.count == 0) {
+            [_topicsByWebSocket removeObjectForKey:webSocket];
+        }
+    }];
+}
+- (NSUInteger)subscriberCountForTopic:(NSString *)topic {
+    NSParameterAssert(topic);
+    __block NSUInteger value = 0;
+    [self executeWorkAndWait:^{
+        value = [_webSocketsByTopic[topic] count];
+    }];
+    return value;
+}
 
 #pragma mark - Connection
 
@@ -161,38 +309,54 @@ void PSWebSocketServerAcceptCallback(CFSocketRef s, CFSocketCallBackType type, C
         return;
     }
     
+    // one listener handing connections out to the threads
+    if(![self listenOnRunLoop:[self acquireRunLoop]]) {
+        [self disconnect:YES];
+        return;
+    }
+    
+    _running = YES;
+    
+    if(!silent) {
+        [self notifyDelegateDidStart];
+    }
+}
+- (BOOL)listenOnRunLoop:(NSRunLoop *)runLoop {
+    PSWebSocketServerListener *listener = [[PSWebSocketServerListener alloc] init];
+    listener.server = self;
+    listener.runLoop = runLoop;
+    _listener = listener;
+    
     // create socket
-    _socket = CFSocketCreate(kCFAllocatorDefault,
-                             PF_INET,
-                             SOCK_STREAM,
-                             IPPROTO_TCP,
-                             kCFSocketAcceptCallBack,
-                             PSWebSocketServerAcceptCallback,
-                             &_socketContext);
+    CFSocketContext socketContext = {0, (__bridge void *)listener, NULL, NULL, NULL};
+    listener.socket = CFSocketCreate(kCFAllocatorDefault,
+                                     PF_INET,
+                                     SOCK_STREAM,
+                                     IPPROTO_TCP,
+                                     kCFSocketAcceptCallBack,
+                                     PSWebSocketServerAcceptCallback,
+                                     &socketContext);
+    if(!listener.socket) {
+        return NO;
+    }
+    
     // configure socket
     int yes = 1;
-    setsockopt(CFSocketGetNative(_socket), SOL_SOCKET, SO_REUSEADDR, (void *)&yes, sizeof(yes));
+    setsockopt(CFSocketGetNative(listener.socket), SOL_SOCKET, SO_REUSEADDR, (void *)&yes, sizeof(yes));
     
     // bind
-    CFSocketError err = CFSocketSetAddress(_socket, (__bridge CFDataRef)_addrData);
+    CFSocketError err = CFSocketSetAddress(listener.socket, (__bridge CFDataRef)_addrData);
     if(err == kCFSocketError) {
-        return;
+        return NO;
     } else if(err == kCFSocketTimeout) {
-        return;
+        return NO;
     }
     
     // schedule
-    _socketRunLoopSource = CFSocketCreateRunLoopSource(kCFAllocatorDefault, _socket, 0);
-    
-    CFRunLoopRef runLoop = [[self runLoop] getCFRunLoop];
-    CFRunLoopAddSource(runLoop, _socketRunLoopSource, kCFRunLoopDefaultMode);
-    CFRelease(runLoop);
-    
-    _running = YES;
+    listener.runLoopSource = CFSocketCreateRunLoopSource(kCFAllocatorDefault, listener.socket, 0);
+    CFRunLoopAddSource([runLoop getCFRunLoop], listener.runLoopSource, kCFRunLoopDefaultMode);
     
-    if(!silent) {
-        [self notifyDelegateDidStart];
-    }
+    return YES;
 }
 - (void)disconnectGracefully:(BOOL)silent {
     if(!_running) {
@@ -200,14 +364,14 @@ void PSWebSocketServerAcceptCallback(CFSocketRef s, CFSocketCallBackType type, C
     }
     
     for(PSWebSocketServerConnection *connection in _connections.allObjects) {
-        [self disconnectConnectionGracefully:connection statusCode:500 description:@"Service Going Away"];
+        [self executeOnConnection:connection work:^{
+            [self disconnectConnectionGracefully:connection statusCode:500 description:@"Service Going Away"];
+        }];
     }
     for(PSWebSocket *webSocket in _webSockets.allObjects) {
         [webSocket close];
     }
     
-    [self pumpOutput];
-    
     // disconnect
     [self executeWork:^{
         [self disconnect:silent];
@@ -216,20 +380,21 @@ void PSWebSocketServerAcceptCallback(CFSocketRef s, CFSocketCallBackType type, C
     _running = NO;
 }
 - (void)disconnect:(BOOL)silent {
-    if(_socketRunLoopSource) {
-        CFRunLoopRef runLoop = [[self runLoop] getCFRunLoop];
-        CFRunLoopRemoveSource(runLoop, _socketRunLoopSource, kCFRunLoopDefaultMode);
-        CFRelease(runLoop);
-        CFRelease(_socketRunLoopSource);
-        _socketRunLoopSource = nil;
-    }
-    
-    if(_socket) {
-        if(CFSocketIsValid(_socket)) {
-            CFSocketInvalidate(_socket);
+    if(_listener) {
+        if(_listener.runLoopSource) {
+            CFRunLoopRemoveSource([_listener.runLoop getCFRunLoop], _listener.runLoopSource, kCFRunLoopDefaultMode);
+            CFRelease(_listener.runLoopSource);
+            _listener.runLoopSource = nil;
         }
-        CFRelease(_socket);
-        _socket = nil;
+        if(_listener.socket) {
+            if(CFSocketIsValid(_listener.socket)) {
+                CFSocketInvalidate(_listener.socket);
+            }
+            CFRelease(_listener.socket);
+            _listener.socket = nil;
+        }
+        [self releaseRunLoop:_listener.runLoop];
+        _listener = nil;
     }
     
     _running = NO;
@@ -242,45 +407,56 @@ void PSWebSocketServerAcceptCallback(CFSocketRef s, CFSocketCallBackType type, C
 #pragma mark - Accepting
 
 - (void)accept:(CFSocketNativeHandle)handle {
-    [self executeWork:^{
-        // create streams
-        CFReadStreamRef readStream = nil;
-        CFWriteStreamRef writeStream = nil;
-        CFStreamCreatePairWithSocket(kCFAllocatorDefault, handle, &readStream, &writeStream);
-        
-        // fail if we couldn't get streams
-        if(!readStream || !writeStream) {
-            return;
+    // runs on the listener's thread, only the connection set is shared with the work queue
+    
+    // create streams
+    CFReadStreamRef readStream = nil;
+    CFWriteStreamRef writeStream = nil;
+    CFStreamCreatePairWithSocket(kCFAllocatorDefault, handle, &readStream, &writeStream);
+    
+    // fail if we couldn't get streams
+    if(!readStream || !writeStream) {
+        if(readStream) {
+            CFRelease(readStream);
         }
-        
-        // configure streams
-        CFReadStreamSetProperty(readStream, kCFStreamPropertyShouldCloseNativeSocket, kCFBooleanTrue);
-        CFWriteStreamSetProperty(writeStream, kCFStreamPropertyShouldCloseNativeSocket, kCFBooleanTrue);
-        
-        // enable SSL
-        if(_secure) {
-            NSMutableDictionary *opts = [NSMutableDictionary dictionary];
-            
-            opts[(__bridge id)kCFStreamSSLIsServer] = @YES;
-            opts[(__bridge id)kCFStreamSSLCertificates] = _SSLCertificates;
-            
-            CFReadStreamSetProperty(readStream, kCFStreamPropertySSLSettings, (__bridge CFDictionaryRef)opts);
-            CFWriteStreamSetProperty(writeStream, kCFStreamPropertySSLSettings, (__bridge CFDictionaryRef)opts);
+        if(writeStream) {
+            CFRelease(writeStream);
         }
+        close(handle);
+        return;
+    }
+    
+    // configure streams
+    CFReadStreamSetProperty(readStream, kCFStreamPropertyShouldCloseNativeSocket, kCFBooleanTrue);
+    CFWriteStreamSetProperty(writeStream, kCFStreamPropertyShouldCloseNativeSocket, kCFBooleanTrue);
+    
+    // enable SSL
+    if(_secure) {
+        NSMutableDictionary *opts = [NSMutableDictionary dictionary];
         
-        // create connection
-        PSWebSocketServerConnection *connection = [[PSWebSocketServerConnection alloc] init];
-        connection.inputStream = CFBridgingRelease(readStream);
-        connection.outputStream = CFBridgingRelease(writeStream);
-        
-        // attach connection
-        [self attachConnection:connection];
-        
-        // open
-        [connection.inputStream open];
-        [connection.outputStream open];
+        opts[(__bridge id)kCFStreamSSLIsServer] = @YES;
+        opts[(__bridge id)kCFStreamSSLCertificates] = _SSLCertificates;
         
-    }];
+        CFReadStreamSetProperty(readStream, kCFStreamPropertySSLSettings, (__bridge CFDictionaryRef)opts);
+        CFWriteStreamSetProperty(writeStream, kCFStreamPropertySSLSettings, (__bridge CFDictionaryRef)opts);
+    }
+    
+    // create connection
+    PSWebSocketServerConnection *connection = [[PSWebSocketServerConnection alloc] init];
+    connection.server = self;
+    connection.inputStream = CFBridgingRelease(readStream);
+    connection.outputStream = CFBridgingRelease(writeStream);
+    connection.nativeSocket = handle;
+    
+    // hand the connection to a thread of the group
+    connection.runLoop = [self acquireRunLoop];
+    
+    // attach connection
+    [self attachConnection:connection];
+    
+    // open
+    [connection.inputStream open];
+    [connection.outputStream open];
 }
 
 #pragma mark - WebSockets
@@ -297,52 +473,221 @@ void PSWebSocketServerAcceptCallback(CFSocketRef s, CFSocketCallBackType type, C
         return;
     }
     [_webSockets removeObject:webSocket];
+    [_openWebSockets removeObject:webSocket];
+    [self unsubscribeWebSocketFromAllTopics:webSocket];
+    [self releaseCompressionMemoryForWebSocket:webSocket];
     webSocket.delegate = nil;
 }
 
+#pragma mark - Topics
+
+- (PSWebSocketPreparedMessage *)preparedMessageWithMessage:(id)message {
+    if([message isKindOfClass:[PSWebSocketPreparedMessage class]]) {
+        return message;
+    }
+    PSWebSocketDeflateOptions *options = (_deflateOptions) ? _deflateOptions : [PSWebSocketDeflateOptions balancedOptions];
+    return [PSWebSocketPreparedMessage preparedMessageWithMessage:message deflateOptions:options];
+}
+- (void)removeWebSocket:(PSWebSocket *)webSocket fromTopic:(NSString *)topic {
+    NSMutableSet *webSockets = _webSocketsByTopic[topic];
+    [webSockets removeObject:webSocket];
+    if(webSockets.count == 0) {
+        [_webSocketsByTopic removeObjectForKey:topic];
+    }
+}
+- (void)unsubscribeWebSocketFromAllTopics:(PSWebSocket *)webSocket {
+    NSMutableSet *topics = [_topicsByWebSocket objectForKey:webSocket];
+    if(!topics) {
+        return;
+    }
+    for(NSString *topic in topics) {
+        [self removeWebSocket:webSocket fromTopic:topic];
+    }
+    [_topicsByWebSocket removeObjectForKey:webSocket];
+}
+
+#pragma mark - Compression Memory
+
+- (PSWebSocketDeflateOptions *)deflateOptionsForRequest:(NSURLRequest *)request memoryCost:(NSUInteger *)outCost {
+    PSWebSocketDeflateOptions *options = (_deflateOptions) ? [_deflateOptions copy] : [PSWebSocketDeflateOptions balancedOptions];
+    *outCost = 0;
+    
+    NSDictionary *offer = [self deflateOfferForRequest:request];
+    if(!options.enabled || !offer) {
+        return options;
+    }
+    
+    // the windows the driver will settle on, the client may ask for a smaller server
+    // window and, if it offered client_max_window_bits, may cap its own
+    NSUInteger serverWindowLimit = (offer[@"server_max_window_bits"]) ? [offer[@"server_max_window_bits"] unsignedIntegerValue] : 15;
+    NSUInteger clientWindowLimit = (offer[@"client_max_window_bits"]) ? MAX([offer[@"client_max_window_bits"] unsignedIntegerValue], 8) : 15;
+    BOOL limitsClientWindow = (offer[@"client_max_window_bits"] != nil);
+    if(serverWindowLimit < 9) {
+        // the driver declines windows zlib can't produce
+        return options;
+    }
+    
+    NSUInteger available = (_compressionMemoryUsage < _compressionMemoryBudget) ? _compressionMemoryBudget - _compressionMemoryUsage : 0;
+    NSUInteger windowBits = options.windowBits;
+    NSUInteger memoryLevel = options.memoryLevel;
+    BOOL noContextTakeover = options.noContextTakeover;
+    
+    // shrink the window, then the memory level, then stop keeping deflate history so
+    // its stream is only held while a message is compressed, then give up
+    while(YES) {
+        NSUInteger deflateWindowBits = MIN(windowBits, serverWindowLimit);
+        NSUInteger inflateWindowBits = (limitsClientWindow) ? MIN(windowBits, clientWindowLimit) : 15;
+        NSUInteger cost = PSWebSocketServerInflateMemoryCost(inflateWindowBits);
+        if(!noContextTakeover) {
+            cost += PSWebSocketServerDeflateMemoryCost(deflateWindowBits, memoryLevel);
+        }
+        if(_compressionMemoryBudget == 0 || cost <= available) {
+            options.windowBits = windowBits;
+            options.memoryLevel = memoryLevel;
+            options.noContextTakeover = noContextTakeover;
+            *outCost = cost;
+            return options;
+        }
+        if(windowBits > 9) {
+            --windowBits;
+        } else if(memoryLevel > 1) {
+            --memoryLevel;
+        } else if(!noContextTakeover) {
+            noContextTakeover = YES;
+        } else {
+            break;
+        }
+    }
+    
+    options.enabled = NO;
+    return options;
+}
+- (NSDictionary *)deflateOfferForRequest:(NSURLRequest *)request {
+    // parameters of the permessage-deflate offer, nil if there is none
+    NSString *extensions = [request valueForHTTPHeaderField:@"Sec-WebSocket-Extensions"];
+    NSCharacterSet *whitespace = [NSCharacterSet whitespaceCharacterSet];
+    NSMutableDictionary *offer = nil;
+    for(NSString *component in [extensions componentsSeparatedByString:@";"]) {
+        NSArray *subcomponents = [component componentsSeparatedByString:@"="];
+        NSString *key = [subcomponents[0] stringByTrimmingCharactersInSet:whitespace];
+        NSString *value = (subcomponents.count > 1) ? [subcomponents[1] stringByTrimmingCharactersInSet:whitespace] : nil;
+        if([key isEqualToString:@"permessage-deflate"]) {
+            offer = [NSMutableDictionary dictionary];
+        } else if(offer && key.length > 0) {
+            offer[key] = (value) ? @([value integerValue]) : @15;
+        }
+    }
+    return offer;
+}
+- (void)reserveCompressionMemory:(NSUInteger)cost forWebSocket:(PSWebSocket *)webSocket {
+    if(cost == 0) {
+        return;
+    }
+    _compressionMemoryUsage += cost;
+    [_compressionMemoryByWebSocket setObject:@(cost) forKey:webSocket];
+}
+- (void)releaseCompressionMemoryForWebSocket:(PSWebSocket *)webSocket {
+    NSNumber *cost = [_compressionMemoryByWebSocket objectForKey:webSocket];
+    if(!cost) {
+        return;
+    }
+    _compressionMemoryUsage -= cost.unsignedIntegerValue;
+    [_compressionMemoryByWebSocket removeObjectForKey:webSocket];
+}
+
 #pragma mark - PSWebSocketDelegate
 
+- (BOOL)respondsToSelector:(SEL)aSelector {
+    // only opt our websockets into optional callbacks our own delegate implements
+    if(aSelector == @selector(webSocket:didReceiveUTF8Message:)) {
+        return [_delegate respondsToSelector:@selector(server:webSocket:didReceiveUTF8Message:)];
+    }
+    if(aSelector == @selector(webSocket:didBeginMessage:)) {
+        return [_delegate respondsToSelector:@selector(server:webSocket:didBeginMessage:)];
+    }
+    if(aSelector == @selector(webSocket:didReceiveMessageChunk:)) {
+        return [_delegate respondsToSelector:@selector(server:webSocket:didReceiveMessageChunk:)];
+    }
+    if(aSelector == @selector(webSocketDidEndMessage:)) {
+        return [_delegate respondsToSelector:@selector(server:webSocketDidEndMessage:)];
+    }
+    if(aSelector == @selector(webSocketDidReachHighWatermark:)) {
+        return [_delegate respondsToSelector:@selector(server:webSocketDidReachHighWatermark:)];
+    }
+    if(aSelector == @selector(webSocketDidDrainToLowWatermark:)) {
+        return [_delegate respondsToSelector:@selector(server:webSocketDidDrainToLowWatermark:)];
+    }
+    return [super respondsToSelector:aSelector];
+}
+
 - (void)webSocketDidOpen:(PSWebSocket *)webSocket {
+    [self executeWork:^{
+        if([_webSockets containsObject:webSocket]) {
+            [_openWebSockets addObject:webSocket];
+        }
+    }];
     [self notifyDelegateWebSocketDidOpen:webSocket];
 }
 - (void)webSocket:(PSWebSocket *)webSocket didReceiveMessage:(id)message {
     [self notifyDelegateWebSocket:webSocket didReceiveMessage:message];
 }
+- (void)webSocket:(PSWebSocket *)webSocket didReceiveUTF8Message:(NSData *)message {
+    [self notifyDelegateWebSocket:webSocket didReceiveUTF8Message:message];
+}
+- (void)webSocket:(PSWebSocket *)webSocket didBeginMessage:(BOOL)binary {
+    [self notifyDelegateWebSocket:webSocket didBeginMessage:binary];
+}
+- (void)webSocket:(PSWebSocket *)webSocket didReceiveMessageChunk:(NSData *)chunk {
+    [self notifyDelegateWebSocket:webSocket didReceiveMessageChunk:chunk];
+}
+- (void)webSocketDidEndMessage:(PSWebSocket *)webSocket {
+    [self notifyDelegateWebSocketDidEndMessage:webSocket];
+}
+- (void)webSocketDidReachHighWatermark:(PSWebSocket *)webSocket {
+    [self notifyDelegateWebSocketDidReachHighWatermark:webSocket];
+}
+- (void)webSocketDidDrainToLowWatermark:(PSWebSocket *)webSocket {
+    [self notifyDelegateWebSocketDidDrainToLowWatermark:webSocket];
+}
 - (void)webSocket:(PSWebSocket *)webSocket didFailWithError:(NSError *)error {
-    [self detachWebSocket:webSocket];
+    [self executeWork:^{
+        [self detachWebSocket:webSocket];
+    }];
     [self notifyDelegateWebSocket:webSocket didFailWithError:error];
 }
 - (void)webSocket:(PSWebSocket *)webSocket didCloseWithCode:(NSInteger)code reason:(NSString *)reason wasClean:(BOOL)wasClean {
-    [self detachWebSocket:webSocket];
+    [self executeWork:^{
+        [self detachWebSocket:webSocket];
+    }];
     [self notifyDelegateWebSocket:webSocket didCloseWithCode:code reason:reason wasClean:wasClean];
 }
 
 #pragma mark - Connections
 
 - (void)attachConnection:(PSWebSocketServerConnection *)connection {
-    if([_connections containsObject:connection]) {
-        return;
-    }
-    [_connections addObject:connection];
-    [_connectionsByStreams setObject:connection forKey:connection.inputStream];
-    [_connectionsByStreams setObject:connection forKey:connection.outputStream];
-    connection.inputStream.delegate = self;
-    connection.outputStream.delegate = self;
-    [connection.inputStream scheduleInRunLoop:[self runLoop] forMode:NSRunLoopCommonModes];
-    [connection.outputStream scheduleInRunLoop:[self runLoop] forMode:NSRunLoopCommonModes];
+    [self executeWork:^{
+        [_connections addObject:connection];
+    }];
+    connection.inputStream.delegate = connection;
+    connection.outputStream.delegate = connection;
+    [connection.inputStream scheduleInRunLoop:connection.runLoop forMode:NSRunLoopCommonModes];
+    [connection.outputStream scheduleInRunLoop:connection.runLoop forMode:NSRunLoopCommonModes];
 }
 - (void)detatchConnection:(PSWebSocketServerConnection *)connection {
-    if(![_connections containsObject:connection]) {
-        return;
-    }
-    [_connections removeObject:connection];
-    [_connectionsByStreams removeObjectForKey:connection.inputStream];
-    [_connectionsByStreams removeObjectForKey:connection.outputStream];
-    [connection.inputStream removeFromRunLoop:[self runLoop] forMode:NSRunLoopCommonModes];
-    [connection.outputStream removeFromRunLoop:[self runLoop] forMode:NSRunLoopCommonModes];
+    [self executeWork:^{
+        [_connections removeObject:connection];
+    }];
+    [connection.inputStream removeFromRunLoop:connection.runLoop forMode:NSRunLoopCommonModes];
+    [connection.outputStream removeFromRunLoop:connection.runLoop forMode:NSRunLoopCommonModes];
     connection.inputStream.delegate = nil;
     connection.outputStream.delegate = nil;
 }
+- (void)executeOnConnection:(PSWebSocketServerConnection *)connection work:(void (^)(void))work {
+    // a connection is only touched on the thread its streams are scheduled on
+    CFRunLoopRef runLoop = [connection.runLoop getCFRunLoop];
+    CFRunLoopPerformBlock(runLoop, kCFRunLoopCommonModes, work);
+    CFRunLoopWakeUp(runLoop);
+}
 - (void)disconnectConnectionGracefully:(PSWebSocketServerConnection *)connection statusCode:(NSInteger)statusCode description:(NSString *)description {
     if(connection.readyState >= PSWebSocketServerConnectionReadyStateClosing) {
         return;
@@ -352,12 +697,14 @@ void PSWebSocketServerAcceptCallback(CFSocketRef s, CFSocketCallBackType type, C
     NSData *data = CFBridgingRelease(CFHTTPMessageCopySerializedMessage(msg));
     CFRelease(msg);
     [connection.outputBuffer appendData:data];
-    [self pumpOutput];
+    [self pumpOutputForConnection:connection];
     __weak typeof(self)weakSelf = self;
     dispatch_after(dispatch_time(DISPATCH_TIME_NOW, 5.0 * NSEC_PER_SEC), _workQueue, ^{
         __strong typeof(weakSelf)strongSelf = weakSelf;
         if(strongSelf) {
-            [strongSelf disconnectConnection:connection];
+            [strongSelf executeOnConnection:connection work:^{
+                [strongSelf disconnectConnection:connection];
+            }];
         }
     });
 }
@@ -367,195 +714,214 @@ void PSWebSocketServerAcceptCallback(CFSocketRef s, CFSocketCallBackType type, C
     }
     connection.readyState = PSWebSocketServerConnectionReadyStateClosed;
     [self detatchConnection:connection];
+    [self releaseRunLoop:connection.runLoop];
     [connection.inputStream close];
     [connection.outputStream close];
 }
 
 #pragma mark - Pumping
 
-- (void)pumpInput {
-    uint8_t chunkBuffer[4096];
-    for(PSWebSocketServerConnection *connection in _connections.allObjects) {
-        if(connection.readyState != PSWebSocketServerConnectionReadyStateOpen ||
-           !connection.inputStream.hasBytesAvailable) {
-            continue;
+- (void)pumpInputForConnection:(PSWebSocketServerConnection *)connection {
+    if(connection.readyState != PSWebSocketServerConnectionReadyStateOpen ||
+       !connection.inputStream.hasBytesAvailable) {
+        return;
+    }
+    
+    // read straight into the tail of the input buffer, never more than a request may be
+    while(connection.inputStream.hasBytesAvailable && connection.inputBuffer.bytesAvailable < PSWebSocketServerMaxRequestLength) {
+        NSUInteger requestedLength = 0;
+        NSInteger readLength = [connection.inputBuffer readFromStream:connection.inputStream
+                                                            maxLength:PSWebSocketServerMaxRequestLength - connection.inputBuffer.bytesAvailable
+                                                      requestedLength:&requestedLength];
+        if(readLength < 0) {
+            [self disconnectConnection:connection];
+            return;
         }
-        
-        while(connection.inputStream.hasBytesAvailable) {
-            NSInteger readLength = [connection.inputStream read:chunkBuffer maxLength:sizeof(chunkBuffer)];
-            if(readLength > 0) {
-                [connection.inputBuffer appendBytes:chunkBuffer length:readLength];
-            } else if(readLength < 0) {
-                [self disconnectConnection:connection];
-            }
-            if(readLength < sizeof(chunkBuffer)) {
-                break;
-            }
+        if(readLength < requestedLength) {
+            break;
         }
+    }
+    
+    if(connection.inputBuffer.bytesAvailable > 4) {
+        // the request has to be contiguous to scan and parse it
+        while([connection.inputBuffer expandContiguousBytes]) {}
         
-        if(connection.inputBuffer.bytesAvailable > 4) {
-            uint8_t boundary[] = {'\r', '\n','\r', '\n'};
-            NSUInteger boundaryOffset = 0;
-            NSUInteger matched = 0;
-            for(NSUInteger i = 0; i < connection.inputBuffer.bytesAvailable; ++i) {
-                const uint8_t byte = ((const uint8_t *)connection.inputBuffer.bytes)[i];
-                const uint8_t boundaryByte = boundary[matched];
-                if(byte == boundaryByte) {
-                    if(++matched == sizeof(boundary)) {
-                        boundaryOffset = i + 1;
-                        break;
-                    }
-                } else {
-                    matched = 0;
+        uint8_t boundary[] = {'\r', '\n','\r', '\n'};
+        NSUInteger boundaryOffset = 0;
+        NSUInteger matched = 0;
+        for(NSUInteger i = 0; i < connection.inputBuffer.bytesAvailable; ++i) {
+            const uint8_t byte = ((const uint8_t *)connection.inputBuffer.bytes)[i];
+            const uint8_t boundaryByte = boundary[matched];
+            if(byte == boundaryByte) {
+                if(++matched == sizeof(boundary)) {
+                    boundaryOffset = i + 1;
+                    break;
                 }
+            } else {
+                matched = 0;
             }
-            if(boundaryOffset == 0) {
-                if(connection.inputBuffer.bytesAvailable >= 16384) {
-                    [self disconnectConnection:connection];
-                }
-                continue;
-            }
-            
-            CFHTTPMessageRef msg = CFHTTPMessageCreateEmpty(kCFAllocatorDefault, YES);
-            CFHTTPMessageAppendBytes(msg, connection.inputBuffer.bytes, connection.inputBuffer.bytesAvailable);
-            if(!CFHTTPMessageIsHeaderComplete(msg)) {
-                [self disconnectConnection:connection];
-                CFRelease(msg);
-                continue;
-            }
-            
-            // move input buffer
-            connection.inputBuffer.offset += boundaryOffset;
-            if(connection.inputBuffer.hasBytesAvailable) {
-                [self disconnectConnection:connection];
-                CFRelease(msg);
-                continue;
-            }
-            
-            NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:CFBridgingRelease(CFHTTPMessageCopyRequestURL(msg))];
-            request.HTTPMethod = CFBridgingRelease(CFHTTPMessageCopyRequestMethod(msg));
-            
-            NSDictionary *headers = CFBridgingRelease(CFHTTPMessageCopyAllHeaderFields(msg));
-            [headers enumerateKeysAndObjectsUsingBlock:^(id key, id obj, BOOL *stop) {
-                [request setValue:obj forHTTPHeaderField:key];
-            }];
-            
-            if(![PSWebSocket isWebSocketRequest:request]) {
+        }
+        if(boundaryOffset == 0) {
+            if(connection.inputBuffer.bytesAvailable >= PSWebSocketServerMaxRequestLength) {
                 [self disconnectConnection:connection];
-                CFRelease(msg);
-                continue;
-            }
-            
-            if(_delegate) {
-                __block BOOL accept = NO;
-                [self executeDelegateAndWait:^{
-                    accept = [_delegate server:self acceptWebSocketWithRequest:request];
-                }];
-                if(!accept) {
-                    [self disconnectConnection:connection];
-                    CFRelease(msg);
-                    continue;
-                }
             }
-            
-            // detach connection
-            [self detatchConnection:connection];
+            return;
+        }
         
-            
-            // create webSocket
-            PSWebSocket *webSocket = [PSWebSocket serverSocketWithRequest:request inputStream:connection.inputStream outputStream:connection.outputStream];
-            
-            // attach webSocket
-            [self attachWebSocket:webSocket];
-            
-            // open webSocket
-            [webSocket open];
-            
-            // clean up
+        CFHTTPMessageRef msg = CFHTTPMessageCreateEmpty(kCFAllocatorDefault, YES);
+        CFHTTPMessageAppendBytes(msg, connection.inputBuffer.bytes, connection.inputBuffer.bytesAvailable);
+        if(!CFHTTPMessageIsHeaderComplete(msg)) {
+            [self disconnectConnection:connection];
             CFRelease(msg);
+            return;
         }
-    }
-}
-- (void)pumpOutput {
-    for(PSWebSocketServerConnection *connection in _connections.allObjects) {
-        if(connection.readyState != PSWebSocketServerConnectionReadyStateOpen &&
-           connection.readyState != PSWebSocketServerConnectionReadyStateClosing) {
-            continue;
+        
+        // move input buffer
+        [connection.inputBuffer consume:boundaryOffset];
+        if(connection.inputBuffer.hasBytesAvailable) {
+            [self disconnectConnection:connection];
+            CFRelease(msg);
+            return;
         }
         
-        while(connection.outputStream.hasSpaceAvailable && connection.outputBuffer.hasBytesAvailable) {
-            NSInteger writeLength = [connection.outputStream write:connection.outputBuffer.bytes maxLength:connection.outputBuffer.bytesAvailable];
-            if(writeLength > 0) {
-                connection.outputBuffer.offset += writeLength;
-            } else if(writeLength < 0) {
+        NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:CFBridgingRelease(CFHTTPMessageCopyRequestURL(msg))];
+        request.HTTPMethod = CFBridgingRelease(CFHTTPMessageCopyRequestMethod(msg));
+        
+        NSDictionary *headers = CFBridgingRelease(CFHTTPMessageCopyAllHeaderFields(msg));
+        [headers enumerateKeysAndObjectsUsingBlock:^(id key, id obj, BOOL *stop) {
+            [request setValue:obj forHTTPHeaderField:key];
+        }];
+        
+        if(![PSWebSocket isWebSocketRequest:request]) {
+            [self disconnectConnection:connection];
+            CFRelease(msg);
+            return;
+        }
+        
+        if(_delegate) {
+            __block BOOL accept = NO;
+            [self executeDelegateAndWait:^{
+                accept = [_delegate server:self acceptWebSocketWithRequest:request];
+            }];
+            if(!accept) {
                 [self disconnectConnection:connection];
-                break;
-            }
-            
-            if(writeLength == 0) {
-                break;
+                CFRelease(msg);
+                return;
             }
         }
         
-        if(connection.readyState == PSWebSocketServerConnectionReadyStateClosing &&
-           !connection.outputBuffer.hasBytesAvailable) {
+        // detach connection, from here on it belongs to the websocket
+        [self detatchConnection:connection];
+        connection.readyState = PSWebSocketServerConnectionReadyStateClosed;
+        
+        // create webSocket, keeping it on the thread its handshake ran on unless its
+        // plain socket is handed over without the streams and watched from its work queue
+        PSWebSocket *webSocket = nil;
+        if(_usesDispatchSources && !_secure) {
+            CFReadStreamSetProperty((__bridge CFReadStreamRef)connection.inputStream, kCFStreamPropertyShouldCloseNativeSocket, kCFBooleanFalse);
+            CFWriteStreamSetProperty((__bridge CFWriteStreamRef)connection.outputStream, kCFStreamPropertyShouldCloseNativeSocket, kCFBooleanFalse);
+            [connection.inputStream close];
+            [connection.outputStream close];
+            webSocket = [PSWebSocket serverSocketWithRequest:request nativeSocket:connection.nativeSocket];
+            [self releaseRunLoop:connection.runLoop];
+        } else if(_eventLoopGroup) {
+            webSocket = [PSWebSocket serverSocketWithRequest:request inputStream:connection.inputStream outputStream:connection.outputStream];
+            [webSocket adoptRunLoop:connection.runLoop fromEventLoopGroup:_eventLoopGroup];
+        } else {
+            webSocket = [PSWebSocket serverSocketWithRequest:request inputStream:connection.inputStream outputStream:connection.outputStream];
+            [self releaseRunLoop:connection.runLoop];
+        }
+        webSocket.maxFrameLength = _maxFrameLength;
+        webSocket.maxMessageLength = _maxMessageLength;
+        webSocket.maxInflatedMessageLength = _maxInflatedMessageLength;
+        webSocket.compressionIdleInterval = _compressionIdleInterval;
+        webSocket.highWatermark = _highWatermark;
+        webSocket.lowWatermark = _lowWatermark;
+        webSocket.maxUndeliveredMessages = _maxUndeliveredMessages;
+        
+        // attach webSocket, the budget and websocket tables are shared with the work queue
+        [self executeWorkAndWait:^{
+            NSUInteger compressionMemoryCost = 0;
+            webSocket.deflateOptions = [self deflateOptionsForRequest:request memoryCost:&compressionMemoryCost];
+            [self attachWebSocket:webSocket];
+            [self reserveCompressionMemory:compressionMemoryCost forWebSocket:webSocket];
+        }];
+        
+        // open webSocket
+        [webSocket open];
+        
+        // clean up
+        CFRelease(msg);
+    }
+}
+- (void)pumpOutputForConnection:(PSWebSocketServerConnection *)connection {
+    if(connection.readyState != PSWebSocketServerConnectionReadyStateOpen &&
+       connection.readyState != PSWebSocketServerConnectionReadyStateClosing) {
+        return;
+    }
+    
+    while(connection.outputStream.hasSpaceAvailable && connection.outputBuffer.hasBytesAvailable) {
+        NSInteger writeLength = [connection.outputStream write:connection.outputBuffer.bytes maxLength:connection.outputBuffer.contiguousBytesAvailable];
+        if(writeLength > 0) {
+            [connection.outputBuffer consume:writeLength];
+        } else if(writeLength < 0) {
             [self disconnectConnection:connection];
+            return;
+        }
+        
+        if(writeLength == 0) {
+            break;
         }
     }
+    
+    if(connection.readyState == PSWebSocketServerConnectionReadyStateClosing &&
+       !connection.outputBuffer.hasBytesAvailable) {
+        [self disconnectConnection:connection];
+    }
 }
 
-#pragma mark - NSStreamDelegate
+#pragma mark - Connection Streams
 
-- (void)stream:(NSStream *)stream handleEvent:(NSStreamEvent)event {
-    [self executeWork:^{
-        if(stream.delegate != self) {
-            [stream.delegate stream:stream handleEvent:event];
-            return;
+- (void)connection:(PSWebSocketServerConnection *)connection stream:(NSStream *)stream handleEvent:(NSStreamEvent)event {
+    if(event == NSStreamEventOpenCompleted) {
+        if(stream == connection.inputStream) {
+            connection.inputStreamOpenCompleted = YES;
+        } else if(stream == connection.outputStream) {
+            connection.outputStreamOpenCompleted = YES;
         }
-        
-        PSWebSocketServerConnection *connection = [_connectionsByStreams objectForKey:stream];
-        NSAssert(connection, @"Connection should not be nil");
-        
-        if(event == NSStreamEventOpenCompleted) {
-            if(stream == connection.inputStream) {
-                connection.inputStreamOpenCompleted = YES;
-            } else if(stream == connection.outputStream) {
-                connection.outputStreamOpenCompleted = YES;
+    }
+    if(!connection.inputStreamOpenCompleted || !connection.outputStreamOpenCompleted) {
+        return;
+    }
+    
+    switch(event) {
+        case NSStreamEventOpenCompleted: {
+            if(connection.readyState == PSWebSocketServerConnectionReadyStateConnecting) {
+                connection.readyState = PSWebSocketServerConnectionReadyStateOpen;
             }
+            [self pumpInputForConnection:connection];
+            [self pumpOutputForConnection:connection];
+            break;
         }
-        if(!connection.inputStreamOpenCompleted || !connection.outputStreamOpenCompleted) {
-            return;
+        case NSStreamEventErrorOccurred: {
+            [self disconnectConnection:connection];
+            break;
         }
-        
-        switch(event) {
-            case NSStreamEventOpenCompleted: {
-                if(connection.readyState == PSWebSocketServerConnectionReadyStateConnecting) {
-                    connection.readyState = PSWebSocketServerConnectionReadyStateOpen;
-                }
-                [self pumpInput];
-                [self pumpOutput];
-                break;
-            }
-            case NSStreamEventErrorOccurred: {
-                [self disconnectConnection:connection];
-                break;
-            }
-            case NSStreamEventEndEncountered: {
-                [self disconnectConnection:connection];
-                break;
-            }
-            case NSStreamEventHasBytesAvailable: {
-                [self pumpInput];
-                break;
-            }
-            case NSStreamEventHasSpaceAvailable: {
-                [self pumpOutput];
-                break;
-            }
-            default:
-                break;
+        case NSStreamEventEndEncountered: {
+            [self disconnectConnection:connection];
+            break;
         }
-    }];
+        case NSStreamEventHasBytesAvailable: {
+            [self pumpInputForConnection:connection];
+            break;
+        }
+        case NSStreamEventHasSpaceAvailable: {
+            [self pumpOutputForConnection:connection];
+            break;
+        }
+        default:
+            break;
+    }
 }
 
 #pragma mark - Delegation
@@ -581,7 +947,36 @@ void PSWebSocketServerAcceptCallback(CFSocketRef s, CFSocketCallBackType type, C
         [_delegate server:self webSocket:webSocket didReceiveMessage:message];
     }];
 }
-
+- (void)notifyDelegateWebSocket:(PSWebSocket *)webSocket didReceiveUTF8Message:(NSData *)message {
+    [self executeDelegate:^{
+        [_delegate server:self webSocket:webSocket didReceiveUTF8Message:message];
+    }];
+}
+- (void)notifyDelegateWebSocket:(PSWebSocket *)webSocket didBeginMessage:(BOOL)binary {
+    [self executeDelegate:^{
+        [_delegate server:self webSocket:webSocket didBeginMessage:binary];
+    }];
+}
+- (void)notifyDelegateWebSocket:(PSWebSocket *)webSocket didReceiveMessageChunk:(NSData *)chunk {
+    [self executeDelegate:^{
+        [_delegate server:self webSocket:webSocket didReceiveMessageChunk:chunk];
+    }];
+}
+- (void)notifyDelegateWebSocketDidEndMessage:(PSWebSocket *)webSocket {
+    [self executeDelegate:^{
+        [_delegate server:self webSocketDidEndMessage:webSocket];
+    }];
+}
+- (void)notifyDelegateWebSocketDidReachHighWatermark:(PSWebSocket *)webSocket {
+    [self executeDelegate:^{
+        [_delegate server:self webSocketDidReachHighWatermark:webSocket];
+    }];
+}
+- (void)notifyDelegateWebSocketDidDrainToLowWatermark:(PSWebSocket *)webSocket {
+    [self executeDelegate:^{
+        [_delegate server:self webSocketDidDrainToLowWatermark:webSocket];
+    }];
+}
 - (void)notifyDelegateWebSocket:(PSWebSocket *)webSocket didFailWithError:(NSError *)error {
     [self executeDelegate:^{
         [_delegate server:self webSocket:webSocket didFailWithError:error];
@@ -623,5 +1018,11 @@ void PSWebSocketServerAcceptCallback(CFSocketRef s, CFSocketCallBackType type, C
 @end
 
 void PSWebSocketServerAcceptCallback(CFSocketRef s, CFSocketCallBackType type, CFDataRef address, const void *data, void *info) {
-    [(__bridge PSWebSocketServer *)info accept:*(CFSocketNativeHandle *)data];
+    PSWebSocketServerListener *listener = (__bridge PSWebSocketServerListener *)info;
+    PSWebSocketServer *server = listener.server;
+    if(server) {
+        [server accept:*(CFSocketNativeHandle *)data];
+    } else {
+        close(*(CFSocketNativeHandle *)data);
+    }
 }
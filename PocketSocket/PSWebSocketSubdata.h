@@ -0,0 +1,36 @@
+//  Copyright 2014 Zwopple Limited
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+/**
+ *  Immutable NSData pointing into the bytes of another NSData which it keeps
+ *  alive. Used to hand out payloads without copying them out of input storage.
+ */
+@interface PSWebSocketSubdata : NSData
+
+#pragma mark - Initialization
+
+/**
+ *  Create a view onto bytes owned by storage
+ *
+ *  @param storage the object owning bytes, retained for the life of the subdata
+ *  @param bytes   start of the view, must lie within storage
+ *  @param length  length of the view
+ *
+ *  @return an initialized subdata
+ */
++ (instancetype)subdataWithStorage:(NSData *)storage bytes:(const void *)bytes length:(NSUInteger)length;
+
+@end
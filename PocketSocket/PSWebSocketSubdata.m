@@ -0,0 +1,54 @@
+//  Copyright 2014 Zwopple Limited
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#import "PSWebSocketSubdata.h"
+
+@interface PSWebSocketSubdata() {
+    NSData *_storage;
+    const void *_bytes;
+    NSUInteger _length;
+}
+@end
+@implementation PSWebSocketSubdata
+
+#pragma mark - Initialization
+
++ (instancetype)subdataWithStorage:(NSData *)storage bytes:(const void *)bytes length:(NSUInteger)length {
+    return [[self alloc] initWithStorage:storage bytes:bytes length:length];
+}
+- (instancetype)initWithStorage:(NSData *)storage bytes:(const void *)bytes length:(NSUInteger)length {
+    NSParameterAssert(storage);
+    NSAssert((const uint8_t *)bytes >= (const uint8_t *)storage.bytes &&
+             (const uint8_t *)bytes + length <= (const uint8_t *)storage.bytes + storage.length, @"Subdata bytes must lie within storage");
+    if((self = [super init])) {
+        _storage = storage;
+        _bytes = bytes;
+        _length = length;
+    }
+    return self;
+}
+
+#pragma mark - NSData
+
+- (NSUInteger)length {
+    return _length;
+}
+- (const void *)bytes {
+    return _bytes;
+}
+- (id)copyWithZone:(NSZone *)zone {
+    return self;
+}
+
+@end
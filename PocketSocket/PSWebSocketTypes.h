@@ -36,7 +36,9 @@ typedef NS_ENUM(NSInteger, PSWebSocketStatusCode) {
     // 1006 reserved
     PSWebSocketStatusCodeInvalidUTF8 = 1007,
     PSWebSocketStatusCodePolicyViolated = 1008,
-    PSWebSocketStatusCodeMessageTooBig = 1009
+    PSWebSocketStatusCodeMessageTooBig = 1009,
+    // 1010 client only
+    PSWebSocketStatusCodeInternalError = 1011
 };
 
 #define PSWebSocketGUID @"258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
@@ -17,4 +17,13 @@
 #define PSWebSocketUTF8DecoderAccept 0
 #define PSWebSocketUTF8DecoderReject 1
 
-uint32_t PSWebSocketUTF8DecoderDecode(uint32_t* state, uint32_t* codep, uint32_t byte);
\ No newline at end of file
+uint32_t PSWebSocketUTF8DecoderDecode(uint32_t* state, uint32_t* codep, uint32_t byte);
+/**
+ *  Validate a chunk of a UTF-8 byte stream. Partial code points are carried
+ *  across chunks in state & codep exactly as with PSWebSocketUTF8DecoderDecode
+ *  so the two can be mixed freely on the same stream.
+ *
+ *  @return PSWebSocketUTF8DecoderReject if the bytes are invalid, otherwise the
+ *          decoder state after the last byte
+ */
+uint32_t PSWebSocketUTF8DecoderValidate(uint32_t* state, uint32_t* codep, const uint8_t* bytes, NSUInteger length);
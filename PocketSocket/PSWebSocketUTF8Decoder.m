@@ -13,6 +13,13 @@
 //  limitations under the License.
 
 #import "PSWebSocketUTF8Decoder.h"
+#if defined(__SSSE3__)
+#import <tmmintrin.h>
+#define PS_UTF8_SIMD 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#import <arm_neon.h>
+#define PS_UTF8_SIMD 1
+#endif
 
 
 // Flexible and Economical UTF-8 Decoder
@@ -47,3 +54,236 @@ uint32_t PSWebSocketUTF8DecoderDecode(uint32_t* state, uint32_t* codep, uint32_t
     return *state;
 }
 
+// Vectorized validation
+// Lookup based UTF-8 validation as described by John Keiser & Daniel Lemire in
+// "Validating UTF-8 In Less Than One Instruction Per Byte" (2020).
+// Every byte is classified by the high nibble of the previous byte, the low
+// nibble of the previous byte and the high nibble of the byte itself. The three
+// 16 entry tables are and'ed together and any bit left over is an error.
+
+#if PS_UTF8_SIMD
+
+#define PS_UTF8_TOO_SHORT (1 << 0)
+#define PS_UTF8_TOO_LONG (1 << 1)
+#define PS_UTF8_OVERLONG_3 (1 << 2)
+#define PS_UTF8_TOO_LARGE (1 << 3)
+#define PS_UTF8_SURROGATE (1 << 4)
+#define PS_UTF8_OVERLONG_2 (1 << 5)
+#define PS_UTF8_TOO_LARGE_1000 (1 << 6)
+#define PS_UTF8_OVERLONG_4 (1 << 6)
+#define PS_UTF8_TWO_CONTS (1 << 7)
+#define PS_UTF8_CARRY (PS_UTF8_TOO_SHORT | PS_UTF8_TOO_LONG | PS_UTF8_TWO_CONTS)
+
+static const uint8_t utf8_byte_1_high_table[16] = {
+    // 0_______ ASCII
+    PS_UTF8_TOO_LONG, PS_UTF8_TOO_LONG, PS_UTF8_TOO_LONG, PS_UTF8_TOO_LONG,
+    PS_UTF8_TOO_LONG, PS_UTF8_TOO_LONG, PS_UTF8_TOO_LONG, PS_UTF8_TOO_LONG,
+    // 10______ continuation
+    PS_UTF8_TWO_CONTS, PS_UTF8_TWO_CONTS, PS_UTF8_TWO_CONTS, PS_UTF8_TWO_CONTS,
+    // 1100____ two byte lead
+    PS_UTF8_TOO_SHORT | PS_UTF8_OVERLONG_2,
+    // 1101____ two byte lead
+    PS_UTF8_TOO_SHORT,
+    // 1110____ three byte lead
+    PS_UTF8_TOO_SHORT | PS_UTF8_OVERLONG_3 | PS_UTF8_SURROGATE,
+    // 1111____ four byte lead
+    PS_UTF8_TOO_SHORT | PS_UTF8_TOO_LARGE | PS_UTF8_TOO_LARGE_1000 | PS_UTF8_OVERLONG_4
+};
+static const uint8_t utf8_byte_1_low_table[16] = {
+    // ____0000
+    PS_UTF8_CARRY | PS_UTF8_OVERLONG_3 | PS_UTF8_OVERLONG_2 | PS_UTF8_OVERLONG_4,
+    // ____0001
+    PS_UTF8_CARRY | PS_UTF8_OVERLONG_2,
+    // ____001_
+    PS_UTF8_CARRY,
+    PS_UTF8_CARRY,
+    // ____0100
+    PS_UTF8_CARRY | PS_UTF8_TOO_LARGE,
+    // ____0101 -> ____1111
+    PS_UTF8_CARRY | PS_UTF8_TOO_LARGE | PS_UTF8_TOO_LARGE_1000,
+    PS_UTF8_CARRY | PS_UTF8_TOO_LARGE | PS_UTF8_TOO_LARGE_1000,
+    PS_UTF8_CARRY | PS_UTF8_TOO_LARGE | PS_UTF8_TOO_LARGE_1000,
+    PS_UTF8_CARRY | PS_UTF8_TOO_LARGE | PS_UTF8_TOO_LARGE_1000,
+    PS_UTF8_CARRY | PS_UTF8_TOO_LARGE | PS_UTF8_TOO_LARGE_1000,
+    PS_UTF8_CARRY | PS_UTF8_TOO_LARGE | PS_UTF8_TOO_LARGE_1000,
+    PS_UTF8_CARRY | PS_UTF8_TOO_LARGE | PS_UTF8_TOO_LARGE_1000,
+    PS_UTF8_CARRY | PS_UTF8_TOO_LARGE | PS_UTF8_TOO_LARGE_1000,
+    // ____1101
+    PS_UTF8_CARRY | PS_UTF8_TOO_LARGE | PS_UTF8_TOO_LARGE_1000 | PS_UTF8_SURROGATE,
+    PS_UTF8_CARRY | PS_UTF8_TOO_LARGE | PS_UTF8_TOO_LARGE_1000,
+    PS_UTF8_CARRY | PS_UTF8_TOO_LARGE | PS_UTF8_TOO_LARGE_1000
+};
+static const uint8_t utf8_byte_2_high_table[16] = {
+    // 0_______ ASCII
+    PS_UTF8_TOO_SHORT, PS_UTF8_TOO_SHORT, PS_UTF8_TOO_SHORT, PS_UTF8_TOO_SHORT,
+    PS_UTF8_TOO_SHORT, PS_UTF8_TOO_SHORT, PS_UTF8_TOO_SHORT, PS_UTF8_TOO_SHORT,
+    // 1000____
+    PS_UTF8_TOO_LONG | PS_UTF8_OVERLONG_2 | PS_UTF8_TWO_CONTS | PS_UTF8_OVERLONG_3 | PS_UTF8_TOO_LARGE_1000 | PS_UTF8_OVERLONG_4,
+    // 1001____
+    PS_UTF8_TOO_LONG | PS_UTF8_OVERLONG_2 | PS_UTF8_TWO_CONTS | PS_UTF8_OVERLONG_3 | PS_UTF8_TOO_LARGE,
+    // 101_____
+    PS_UTF8_TOO_LONG | PS_UTF8_OVERLONG_2 | PS_UTF8_TWO_CONTS | PS_UTF8_SURROGATE | PS_UTF8_TOO_LARGE,
+    PS_UTF8_TOO_LONG | PS_UTF8_OVERLONG_2 | PS_UTF8_TWO_CONTS | PS_UTF8_SURROGATE | PS_UTF8_TOO_LARGE,
+    // 11______ lead
+    PS_UTF8_TOO_SHORT, PS_UTF8_TOO_SHORT, PS_UTF8_TOO_SHORT, PS_UTF8_TOO_SHORT
+};
+
+#if defined(__SSSE3__)
+
+typedef __m128i utf8_vector;
+
+static inline utf8_vector utf8_load(const uint8_t *bytes) { return _mm_loadu_si128((const __m128i *)bytes); }
+static inline utf8_vector utf8_table(const uint8_t *table) { return _mm_loadu_si128((const __m128i *)table); }
+static inline utf8_vector utf8_zero(void) { return _mm_setzero_si128(); }
+static inline utf8_vector utf8_or(utf8_vector a, utf8_vector b) { return _mm_or_si128(a, b); }
+static inline utf8_vector utf8_and(utf8_vector a, utf8_vector b) { return _mm_and_si128(a, b); }
+static inline utf8_vector utf8_xor(utf8_vector a, utf8_vector b) { return _mm_xor_si128(a, b); }
+static inline utf8_vector utf8_splat(uint8_t value) { return _mm_set1_epi8((char)value); }
+static inline utf8_vector utf8_saturating_sub(utf8_vector a, utf8_vector b) { return _mm_subs_epu8(a, b); }
+static inline utf8_vector utf8_high_nibbles(utf8_vector a) { return _mm_and_si128(_mm_srli_epi16(a, 4), _mm_set1_epi8(0x0F)); }
+static inline utf8_vector utf8_low_nibbles(utf8_vector a) { return _mm_and_si128(a, _mm_set1_epi8(0x0F)); }
+static inline utf8_vector utf8_lookup(utf8_vector table, utf8_vector nibbles) { return _mm_shuffle_epi8(table, nibbles); }
+static inline utf8_vector utf8_prev1(utf8_vector input, utf8_vector prev) { return _mm_alignr_epi8(input, prev, 15); }
+static inline utf8_vector utf8_prev2(utf8_vector input, utf8_vector prev) { return _mm_alignr_epi8(input, prev, 14); }
+static inline utf8_vector utf8_prev3(utf8_vector input, utf8_vector prev) { return _mm_alignr_epi8(input, prev, 13); }
+static inline BOOL utf8_is_ascii(utf8_vector a) { return _mm_movemask_epi8(a) == 0; }
+static inline BOOL utf8_any(utf8_vector a) { return _mm_movemask_epi8(_mm_cmpeq_epi8(a, _mm_setzero_si128())) != 0xFFFF; }
+
+#else
+
+typedef uint8x16_t utf8_vector;
+
+static inline utf8_vector utf8_load(const uint8_t *bytes) { return vld1q_u8(bytes); }
+static inline utf8_vector utf8_table(const uint8_t *table) { return vld1q_u8(table); }
+static inline utf8_vector utf8_zero(void) { return vdupq_n_u8(0); }
+static inline utf8_vector utf8_or(utf8_vector a, utf8_vector b) { return vorrq_u8(a, b); }
+static inline utf8_vector utf8_and(utf8_vector a, utf8_vector b) { return vandq_u8(a, b); }
+static inline utf8_vector utf8_xor(utf8_vector a, utf8_vector b) { return veorq_u8(a, b); }
+static inline utf8_vector utf8_splat(uint8_t value) { return vdupq_n_u8(value); }
+static inline utf8_vector utf8_saturating_sub(utf8_vector a, utf8_vector b) { return vqsubq_u8(a, b); }
+static inline utf8_vector utf8_high_nibbles(utf8_vector a) { return vshrq_n_u8(a, 4); }
+static inline utf8_vector utf8_low_nibbles(utf8_vector a) { return vandq_u8(a, vdupq_n_u8(0x0F)); }
+static inline utf8_vector utf8_lookup(utf8_vector table, utf8_vector nibbles) { return vqtbl1q_u8(table, nibbles); }
+static inline utf8_vector utf8_prev1(utf8_vector input, utf8_vector prev) { return vextq_u8(prev, input, 15); }
+static inline utf8_vector utf8_prev2(utf8_vector input, utf8_vector prev) { return vextq_u8(prev, input, 14); }
+static inline utf8_vector utf8_prev3(utf8_vector input, utf8_vector prev) { return vextq_u8(prev, input, 13); }
+static inline BOOL utf8_is_ascii(utf8_vector a) { return vmaxvq_u8(a) < 0x80; }
+static inline BOOL utf8_any(utf8_vector a) { return vmaxvq_u8(a) != 0; }
+
+#endif
+
+static inline utf8_vector utf8_check_block(utf8_vector input, utf8_vector prev) {
+    utf8_vector prev1 = utf8_prev1(input, prev);
+    utf8_vector special = utf8_and(utf8_and(utf8_lookup(utf8_table(utf8_byte_1_high_table), utf8_high_nibbles(prev1)),
+                                            utf8_lookup(utf8_table(utf8_byte_1_low_table), utf8_low_nibbles(prev1))),
+                                   utf8_lookup(utf8_table(utf8_byte_2_high_table), utf8_high_nibbles(input)));
+
+    // 3rd & 4th bytes of a sequence must be continuations, flagged by 0x80 so
+    // the xor cancels the TWO_CONTS bit the tables set for them
+    utf8_vector third = utf8_saturating_sub(utf8_prev2(input, prev), utf8_splat(0xE0 - 0x80));
+    utf8_vector fourth = utf8_saturating_sub(utf8_prev3(input, prev), utf8_splat(0xF0 - 0x80));
+    utf8_vector must23 = utf8_and(utf8_or(third, fourth), utf8_splat(0x80));
+    return utf8_xor(must23, special);
+}
+
+// Validates complete 16 byte blocks starting on a code point boundary. A
+// sequence left open at the very end is not an error here; the caller
+// finishes it with the DFA.
+static BOOL PSWebSocketUTF8ValidateBlocks(const uint8_t *bytes, NSUInteger length) {
+    // a block is left incomplete if it ends inside a 2, 3 or 4 byte sequence
+    static const uint8_t incompleteMax[16] = {
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xF0 - 1, 0xE0 - 1, 0xC0 - 1
+    };
+    utf8_vector maxValues = utf8_table(incompleteMax);
+    utf8_vector error = utf8_zero();
+    utf8_vector prev = utf8_zero();
+    utf8_vector prevIncomplete = utf8_zero();
+    NSUInteger i = 0;
+    for(; length - i >= 32; i += 32) {
+        utf8_vector a = utf8_load(bytes + i);
+        utf8_vector b = utf8_load(bytes + i + 16);
+        if(utf8_is_ascii(utf8_or(a, b))) {
+            // only an unfinished sequence in the previous block can fail here
+            error = utf8_or(error, prevIncomplete);
+            prevIncomplete = utf8_zero();
+        } else {
+            error = utf8_or(error, utf8_check_block(a, prev));
+            error = utf8_or(error, utf8_check_block(b, a));
+            prevIncomplete = utf8_saturating_sub(b, maxValues);
+        }
+        prev = b;
+        if(utf8_any(error)) {
+            return NO;
+        }
+    }
+    for(; length - i >= 16; i += 16) {
+        utf8_vector a = utf8_load(bytes + i);
+        error = utf8_or(error, utf8_check_block(a, prev));
+        prev = a;
+    }
+    return !utf8_any(error);
+}
+
+#endif
+
+uint32_t PSWebSocketUTF8DecoderValidate(uint32_t* state, uint32_t* codep, const uint8_t* bytes, NSUInteger length) {
+    NSUInteger i = 0;
+    
+    // finish any code point carried over from a previous chunk
+    while(i < length && *state != PSWebSocketUTF8DecoderAccept) {
+        if(PSWebSocketUTF8DecoderDecode(state, codep, bytes[i++]) == PSWebSocketUTF8DecoderReject) {
+            return PSWebSocketUTF8DecoderReject;
+        }
+    }
+    
+#if PS_UTF8_SIMD
+    NSUInteger blocksLength = (length - i) & ~(NSUInteger)15;
+    if(blocksLength > 0) {
+        if(!PSWebSocketUTF8ValidateBlocks(bytes + i, blocksLength)) {
+            *state = PSWebSocketUTF8DecoderReject;
+            return *state;
+        }
+        
+        // back up to the lead byte of a sequence that runs past the blocks
+        NSUInteger end = i + blocksLength;
+        NSUInteger resume = end;
+        if(bytes[end - 3] >= 0xF0) {
+            resume = end - 3;
+        } else if(bytes[end - 2] >= 0xE0) {
+            resume = end - 2;
+        } else if(bytes[end - 1] >= 0xC0) {
+            resume = end - 1;
+        }
+        i = resume;
+    }
+    
+    for(; i < length; ++i) {
+        if(PSWebSocketUTF8DecoderDecode(state, codep, bytes[i]) == PSWebSocketUTF8DecoderReject) {
+            return PSWebSocketUTF8DecoderReject;
+        }
+    }
+#else
+    static const uint64_t highBits = 0x8080808080808080ULL;
+    while(i < length) {
+        // skip ascii a word at a time whenever we sit between code points
+        if(*state == PSWebSocketUTF8DecoderAccept && bytes[i] < 0x80) {
+            while(length - i >= 4 * sizeof(uint64_t)) {
+                uint64_t words[4];
+                memcpy(words, bytes + i, sizeof(words));
+                if((words[0] | words[1] | words[2] | words[3]) & highBits) {
+                    break;
+                }
+                i += sizeof(words);
+            }
+            if(i == length) {
+                break;
+            }
+        }
+        if(PSWebSocketUTF8DecoderDecode(state, codep, bytes[i++]) == PSWebSocketUTF8DecoderReject) {
+            return PSWebSocketUTF8DecoderReject;
+        }
+    }
+#endif
+    return *state;
+}